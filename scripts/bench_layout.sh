@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# Renders each preset by scanning the triangles in file order and through
+# the hierarchy (-a, welded vertices in Morton order), and prints the best
+# wall time of a few runs along with the -P cache counters of the last run.
+# Run from the repository root after building, e.g.
+#
+#     scripts/bench_layout.sh            # 400x300, 3 runs, one thread
+#     scripts/bench_layout.sh -n 8       # extra arguments go to every run
+set -e
+
+RT=${RT:-bin/rt}
+RUNS=${RUNS:-3}
+SIZE=${SIZE:-"-w 400 -h 300"}
+OUT=$(mktemp --suffix .ppm)
+trap 'rm -f "$OUT"' EXIT
+
+for preset in teapot teddy-bear; do
+    for layout in "" "-a"; do
+        best=""
+        for ((i = 0; i < RUNS; i++)); do
+            start=$(date +%s%N)
+            counters=$("$RT" -p "$preset" $SIZE -P $layout "$@" -o "$OUT" 2>&1 | grep -o 'Perf: .*' || true)
+            ms=$((($(date +%s%N) - start) / 1000000))
+            if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then best=$ms; fi
+        done
+        printf "%-10s %-3s %6d ms  %s\n" "$preset" "${layout:--}" "$best" "$counters"
+    done
+done
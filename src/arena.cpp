@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "arena.h"
+
+static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+struct ArenaBlock {
+    ArenaBlock* prev;
+    size_t size;  // mapped bytes, including this header
+    size_t used;  // used bytes, including this header
+};
+
+static size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+static ArenaBlock* map_block(size_t size, bool huge_pages) {
+    size_t page = huge_pages ? HUGE_PAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+    size = round_up(size, page);
+
+    // mmap only promises page alignment, map one huge page more and trim
+    // the ends so that the block starts on a huge page boundary.
+    size_t map_size = huge_pages ? size + HUGE_PAGE_SIZE : size;
+    void* p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+
+    u8* start = (u8*) p;
+    if (huge_pages) {
+        start = (u8*) round_up((uintptr_t) p, HUGE_PAGE_SIZE);
+        size_t head = start - (u8*) p;
+        if (head > 0) munmap(p, head);
+        munmap(start + size, map_size - head - size);
+#ifdef MADV_HUGEPAGE
+        madvise(start, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    ArenaBlock* block = (ArenaBlock*) start;
+    block->prev = NULL;
+    block->size = size;
+    block->used = sizeof(ArenaBlock);
+    return block;
+}
+
+Arena arena_create(const char* name, size_t block_size, bool huge_pages) {
+    return Arena {
+        .name = name,
+        .block_size = block_size,
+        .huge_pages = huge_pages,
+        .block = NULL,
+        .used = 0,
+        .mapped = 0,
+        .peak_used = 0,
+        .peak_mapped = 0
+    };
+}
+
+void* Arena::push(size_t size, size_t align) {
+    size_t offset = 0;
+    if (block != NULL) {
+        offset = round_up((uintptr_t) block + block->used, align) - (uintptr_t) block;
+    }
+    if (block == NULL || offset + size > block->size) {
+        size_t needed = round_up(sizeof(ArenaBlock), align) + size;
+        ArenaBlock* next = map_block(needed > block_size ? needed : block_size, huge_pages);
+        if (next == NULL) {
+            fprintf(stderr, "Arena \"%s\": failed to map %zu bytes\n", name, needed);
+            exit(1);
+        }
+        next->prev = block;
+        block = next;
+        mapped += block->size;
+        if (mapped > peak_mapped) peak_mapped = mapped;
+        offset = round_up((uintptr_t) block + block->used, align) - (uintptr_t) block;
+    }
+
+    used += offset + size - block->used;
+    if (used > peak_used) peak_used = used;
+    block->used = offset + size;
+    return (u8*) block + offset;
+}
+
+void* Arena::push_zero(size_t size, size_t align) {
+    void* p = push(size, align);
+    memset(p, 0, size);
+    return p;
+}
+
+void Arena::reset() {
+    if (block != NULL && block->prev != NULL) {
+        // In one block the allocations that started the old blocks are
+        // padded differently, by less than max_align_t each; leave room
+        // for that so the same allocations fit again.
+        int blocks = 0;
+        for (ArenaBlock* b = block; b != NULL; b = b->prev) blocks++;
+        size_t total = used + blocks * (sizeof(ArenaBlock) + alignof(max_align_t));
+        release();
+        block = map_block(total > block_size ? total : block_size, huge_pages);
+        if (block != NULL) mapped = block->size;
+    }
+    if (block != NULL) block->used = sizeof(ArenaBlock);
+    used = 0;
+}
+
+void Arena::release() {
+    while (block != NULL) {
+        ArenaBlock* prev = block->prev;
+        munmap(block, block->size);
+        block = prev;
+    }
+    used = 0;
+    mapped = 0;
+}
+
+void Arena::fprint_stats(FILE* f) const {
+    fprintf(
+        f,
+        "Memory (%s arena): %.2f MB used, %.2f MB mapped at peak\n",
+        name,
+        peak_used / 1e6,
+        peak_mapped / 1e6
+    );
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include "common.h"
+
+struct ArenaBlock;
+
+// Linear allocator for data that shares a lifetime, e.g. everything
+// belonging to the loaded scene or to a single frame. Memory comes straight
+// from mmap in large blocks; allocations are never freed one by one, the
+// whole arena is `reset` for the next frame or `release`d at the end.
+//
+// With `huge_pages` blocks are 2 MB aligned and advised to be backed by
+// transparent huge pages, which cuts TLB misses when the renderer walks
+// large triangle arrays.
+struct Arena {
+    const char* name;
+    size_t block_size;
+    bool huge_pages;
+    ArenaBlock* block;
+
+    size_t used;         // bytes handed out, including alignment padding
+    size_t mapped;
+    size_t peak_used;
+    size_t peak_mapped;
+
+    void* push(size_t size, size_t align = alignof(max_align_t));
+    void* push_zero(size_t size, size_t align = alignof(max_align_t));
+
+    template <typename T>
+    T* push_array(size_t count) {
+        return (T*) push(sizeof(T) * count, alignof(T));
+    }
+
+    template <typename T>
+    T* push_array_zero(size_t count) {
+        return (T*) push_zero(sizeof(T) * count, alignof(T));
+    }
+
+    // Forgets all allocations. If the arena grew past one block, the blocks
+    // are replaced by a single one large enough for the same allocations,
+    // padding included, so a frame that repeats the previous one's
+    // allocations (with alignments up to max_align_t) maps nothing.
+    void reset();
+    void release();
+
+    void fprint_stats(FILE* f) const;
+};
+
+Arena arena_create(const char* name, size_t block_size, bool huge_pages);
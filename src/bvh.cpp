@@ -0,0 +1,520 @@
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include "bvh.h"
+#include "layout.h"
+#include "vec3.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static_assert(sizeof(BvhNode) == 48, "BvhNode should stay 48 bytes");
+
+// Boxes grow by this fraction of their coordinates' magnitude before they
+// are quantized, far more than the f32 box test can be off by.
+const f64 BVH_PAD = 1.0 / (1 << 18);
+// Relative slack on the entry and exit distances of the box test.
+const f32 BVH_T_SLACK = 1.0f / (1 << 16);
+// Direction components are clamped to this inverse, so the box test never
+// multiplies a zero by an infinity.
+const f32 BVH_MAX_INV = 1e30f;
+// A split path takes at most 63 Morton bits plus ~31 halvings, and each
+// level leaves at most three siblings on the stack.
+const int BVH_STACK_SIZE = 512;
+const u32 BVH_LEAF_REF = 1u << 31;
+const int BVH_MAX_OFFSET = 0xFFFF;
+
+struct BvhBox {
+    Vec3 lo, hi;
+};
+
+static const BvhBox EMPTY_BOX = {
+    .lo = { .x = F64_INF, .y = F64_INF, .z = F64_INF },
+    .hi = { .x = -F64_INF, .y = -F64_INF, .z = -F64_INF }
+};
+
+static inline f64 axis(const Vec3& v, int a) {
+    return a == 0 ? v.x : a == 1 ? v.y : v.z;
+}
+
+static void box_add(BvhBox& box, const Vec3& p) {
+    box.lo = Vec3 { .x = fmin(box.lo.x, p.x), .y = fmin(box.lo.y, p.y), .z = fmin(box.lo.z, p.z) };
+    box.hi = Vec3 { .x = fmax(box.hi.x, p.x), .y = fmax(box.hi.y, p.y), .z = fmax(box.hi.z, p.z) };
+}
+
+static void box_add_box(BvhBox& box, const BvhBox& other) {
+    box_add(box, other.lo);
+    box_add(box, other.hi);
+}
+
+static inline u32 read_u32(const u16* p) {
+    return p[0] | (u32) p[1] << 16;
+}
+
+static inline void write_u32(u16* p, u32 v) {
+    p[0] = v & 0xFFFF;
+    p[1] = v >> 16;
+}
+
+static inline int block_count(const u16* block) {
+    return read_u32(block) & 0xF;
+}
+
+static inline size_t block_size(int count) {
+    return 2 + 5 * (size_t) count;
+}
+
+// 2^exponent, built from its bits like the SIMD decode does.
+static inline f32 quantum(i8 exponent) {
+    u32 bits = (u32) (exponent + 127) << 23;
+    f32 step;
+    memcpy(&step, &bits, sizeof(step));
+    return step;
+}
+
+// Stores the children's boxes in the node, rounded outwards to the 8-bit
+// grid spanning their union, and returns the union.
+static BvhBox quantize_node(BvhNode& node, const BvhBox* boxes, int count) {
+    BvhBox box = EMPTY_BOX;
+    for (int k = 0; k < count; k++) box_add_box(box, boxes[k]);
+
+    for (int a = 0; a < 3; a++) {
+        f64 lo = axis(box.lo, a);
+        f64 hi = axis(box.hi, a);
+        f64 pad = BVH_PAD * (fmax(fabs(lo), fabs(hi)) + (hi - lo)) + ldexp(1, -100);
+        f32 origin = (f32) (lo - pad);
+        if (origin > lo - pad) origin = nextafterf(origin, -INFINITY);
+        int exponent;
+        frexp((hi + pad - origin) / 255, &exponent);
+        if (exponent < -100) exponent = -100;
+        f64 step = quantum(exponent);
+
+        node.origin[a] = origin;
+        node.exponent[a] = (i8) exponent;
+        for (int k = 0; k < BVH_WIDTH; k++) {
+            f64 q_lo = 0;
+            f64 q_hi = 0;
+            if (k < count) {
+                q_lo = floor((axis(boxes[k].lo, a) - pad - origin) / step);
+                q_hi = ceil((axis(boxes[k].hi, a) + pad - origin) / step);
+            }
+            node.lo[a][k] = (u8) fmax(0, fmin(255, q_lo));
+            node.hi[a][k] = (u8) fmax(0, fmin(255, q_hi));
+        }
+    }
+    return box;
+}
+
+struct BvhRange {
+    int first, last;
+
+    inline int count() const { return last - first; }
+};
+
+struct BvhBuilder {
+    const Obj::Mesh* mesh;
+    const MortonKey* keys;  // faces in curve order
+    const BvhBox* boxes;    // of the faces in curve order
+    int* copies;            // latest copy of each mesh vertex, -1 before its first use
+    Bvh* bvh;
+};
+
+static BvhBox range_box(const BvhBuilder& b, BvhRange range) {
+    BvhBox box = EMPTY_BOX;
+    for (int i = range.first; i < range.last; i++) box_add_box(box, b.boxes[i]);
+    return box;
+}
+
+// Splits where the highest bit in which the range's codes differ flips, or
+// in the middle when they are all the same.
+static int split_range(const MortonKey* keys, BvhRange range) {
+    u64 first = keys[range.first].code;
+    u64 last = keys[range.last - 1].code;
+    if (first == last) return (range.first + range.last) / 2;
+    u64 bit = 1ull << (63 - __builtin_clzll(first ^ last));
+    // keys[lo] doesn't have the bit, keys[hi] has it.
+    int lo = range.first;
+    int hi = range.last - 1;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (keys[mid].code & bit) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    return hi;
+}
+
+// Splits the largest child until there are BVH_WIDTH of them or all fit in
+// a leaf. The children stay in curve order.
+static int split_children(const MortonKey* keys, BvhRange range, BvhRange* children) {
+    int count = 1;
+    children[0] = range;
+    while (count < BVH_WIDTH) {
+        int largest = -1;
+        for (int k = 0; k < count; k++) {
+            int size = children[k].count();
+            if (size > BVH_LEAF_SIZE && (largest == -1 || size > children[largest].count())) largest = k;
+        }
+        if (largest == -1) break;
+
+        int mid = split_range(keys, children[largest]);
+        for (int k = count; k > largest + 1; k--) children[k] = children[k - 1];
+        children[largest + 1] = BvhRange { .first = mid, .last = children[largest].last };
+        children[largest].last = mid;
+        count++;
+    }
+    return count;
+}
+
+// Appends the range's triangle block. Vertices are numbered in the order
+// the blocks first use them; one last used too far back for a 16-bit
+// offset is copied again.
+static void write_block(BvhBuilder& b, BvhRange range) {
+    const Obj::Mesh& mesh = *b.mesh;
+    Bvh& bvh = *b.bvh;
+    int count = range.count();
+    int reach = bvh.vertices_count + 3 * count - 1 - BVH_MAX_OFFSET;
+
+    u32 corners[3 * BVH_LEAF_SIZE];
+    u32 base = UINT32_MAX;
+    for (int i = 0; i < count; i++) {
+        const Obj::Face& face = mesh.faces[b.keys[range.first + i].index];
+        for (int c = 0; c < 3; c++) {
+            int v = (int) (face.gv[c] - mesh.vertices);
+            if (b.copies[v] == -1 || b.copies[v] < reach) {
+                b.copies[v] = bvh.vertices_count;
+                bvh.vertices[bvh.vertices_count++] = mesh.vertices[v];
+            }
+            corners[3 * i + c] = b.copies[v];
+            if (corners[3 * i + c] < base) base = corners[3 * i + c];
+        }
+    }
+
+    u16* block = bvh.blocks + bvh.blocks_size;
+    write_u32(block, base << 4 | count);
+    for (int i = 0; i < count; i++) {
+        int face = b.keys[range.first + i].index;
+        u16* triangle = block + block_size(i);
+        write_u32(triangle, face);
+        for (int c = 0; c < 3; c++) triangle[2 + c] = (u16) (corners[3 * i + c] - base);
+    }
+    bvh.blocks_size += block_size(count);
+    bvh.leaves_count++;
+}
+
+static void build_node(BvhBuilder& b, int index, BvhRange range) {
+    Bvh& bvh = *b.bvh;
+    BvhRange children[BVH_WIDTH];
+    int count = split_children(b.keys, range, children);
+
+    BvhNode& node = bvh.nodes[index];
+    node.kinds = 0;
+    node.first_node = bvh.nodes_count;
+    node.first_block = (u32) bvh.blocks_size;
+    BvhBox boxes[BVH_WIDTH];
+    for (int k = 0; k < count; k++) {
+        boxes[k] = range_box(b, children[k]);
+        if (children[k].count() <= BVH_LEAF_SIZE) {
+            node.kinds |= 1 << k;
+            write_block(b, children[k]);
+        } else {
+            node.kinds |= 16 << k;
+            bvh.nodes_count++;
+        }
+    }
+    quantize_node(node, boxes, count);
+
+    int next = node.first_node;
+    for (int k = 0; k < count; k++) {
+        if (node.kinds & 16 << k) build_node(b, next++, children[k]);
+    }
+}
+
+Bvh* bvh_create(const Obj::Mesh& mesh, bool posable, Arena& arena, Arena& scratch) {
+    int m = mesh.faces_count;
+    // Vertex bases take 28 bits and every corner may need its own vertex.
+    if (3 * (i64) m >= 1 << 28) {
+        fprintf(stderr, "Too many triangles for the hierarchy: %d\n", m);
+        exit(1);
+    }
+
+    Vec3* centroids = scratch.push_array<Vec3>(m);
+    for (int f = 0; f < m; f++) {
+        const Obj::Face& face = mesh.faces[f];
+        centroids[f] = (*face.gv[0] + *face.gv[1] + *face.gv[2]) / 3;
+    }
+    MortonKey* keys = sort_morton(centroids, m, scratch);
+    BvhBox* boxes = scratch.push_array<BvhBox>(m);
+    for (int i = 0; i < m; i++) {
+        const Obj::Face& face = mesh.faces[keys[i].index];
+        boxes[i] = EMPTY_BOX;
+        for (int c = 0; c < 3; c++) box_add(boxes[i], *face.gv[c]);
+    }
+    int* copies = scratch.push_array<int>(mesh.vertices_count);
+    for (int i = 0; i < mesh.vertices_count; i++) copies[i] = -1;
+
+    // Built at the largest possible sizes in scratch, then copied out.
+    Bvh build = {
+        .triangles_count = m,
+        .vertices_count = 0,
+        .nodes_count = 1,
+        .leaves_count = 0,
+        .blocks_size = 0,
+        .nodes = scratch.push_array_zero<BvhNode>(m + 1),
+        .blocks = scratch.push_array<u16>(block_size(0) * (m + 1) + 5 * (size_t) m),
+        .vertices = scratch.push_array<Vec3>(3 * (size_t) m),
+        .rest = NULL,
+        .triangle_blocks = NULL,
+        .center = mesh_center(mesh)
+    };
+    if (m > 0) {
+        BvhBuilder b = { .mesh = &mesh, .keys = keys, .boxes = boxes, .copies = copies, .bvh = &build };
+        build_node(b, 0, BvhRange { .first = 0, .last = m });
+    }
+
+    Bvh* bvh = arena.push_array<Bvh>(1);
+    *bvh = build;
+    bvh->nodes = arena.push_array<BvhNode>(build.nodes_count);
+    memcpy(bvh->nodes, build.nodes, sizeof(BvhNode) * build.nodes_count);
+    bvh->blocks = arena.push_array<u16>(build.blocks_size);
+    memcpy(bvh->blocks, build.blocks, sizeof(u16) * build.blocks_size);
+    bvh->vertices = arena.push_array<Vec3>(build.vertices_count);
+    memcpy(bvh->vertices, build.vertices, sizeof(Vec3) * build.vertices_count);
+    bvh->rest = bvh->vertices;
+    if (posable) {
+        bvh->rest = arena.push_array<Vec3>(build.vertices_count);
+        memcpy(bvh->rest, build.vertices, sizeof(Vec3) * build.vertices_count);
+    }
+    return bvh;
+}
+
+static BvhBox block_box(const Bvh& bvh, const u16* block) {
+    BvhBox box = EMPTY_BOX;
+    u32 base = read_u32(block) >> 4;
+    int count = block_count(block);
+    for (int i = 0; i < count; i++) {
+        const u16* triangle = block + block_size(i);
+        for (int c = 0; c < 3; c++) box_add(box, bvh.vertices[base + triangle[2 + c]]);
+    }
+    return box;
+}
+
+static BvhBox refit_node(Bvh& bvh, int index) {
+    BvhNode& node = bvh.nodes[index];
+    BvhBox boxes[BVH_WIDTH];
+    int count = 0;
+    u32 next = node.first_node;
+    const u16* block = bvh.blocks + node.first_block;
+    for (int k = 0; k < BVH_WIDTH; k++) {
+        if (node.kinds & 1 << k) {
+            boxes[count++] = block_box(bvh, block);
+            block += block_size(block_count(block));
+        } else if (node.kinds & 16 << k) {
+            boxes[count++] = refit_node(bvh, next++);
+        }
+    }
+    return quantize_node(node, boxes, count);
+}
+
+void bvh_pose(Bvh& bvh, f64 angle) {
+    if (bvh.rest == bvh.vertices) return;
+    f64 c = cos(angle);
+    f64 s = sin(angle);
+    for (int i = 0; i < bvh.vertices_count; i++) {
+        // Leave the unrotated mesh bit for bit as it was loaded.
+        bvh.vertices[i] = angle != 0 ? turntable_point(bvh.rest[i], bvh.center, c, s) : bvh.rest[i];
+    }
+    if (bvh.triangles_count > 0) refit_node(bvh, 0);
+}
+
+struct BoxRay {
+    f32 origin[3];
+    f32 inv[3];
+};
+
+// Bit mask of the children whose boxes the ray passes through before
+// `t_max`, their entry distances go to `t_near`.
+#ifdef __SSE2__
+static inline __m128 decode_bounds(const u8* q, f32 origin, i8 exponent) {
+    i32 bytes;
+    memcpy(&bytes, q, sizeof(bytes));
+    __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+    return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(quantum(exponent))));
+}
+
+static inline int hit_children(const BvhNode& node, const BoxRay& ray, f32 t_max, f32* t_near) {
+    __m128 near = _mm_setzero_ps();
+    __m128 far = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m128 origin = _mm_set1_ps(ray.origin[a]);
+        __m128 inv = _mm_set1_ps(ray.inv[a]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(decode_bounds(node.lo[a], node.origin[a], node.exponent[a]), origin), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(decode_bounds(node.hi[a], node.origin[a], node.exponent[a]), origin), inv);
+        near = _mm_max_ps(near, _mm_min_ps(t0, t1));
+        far = _mm_min_ps(far, _mm_max_ps(t0, t1));
+    }
+    near = _mm_mul_ps(near, _mm_set1_ps(1 - BVH_T_SLACK));
+    far = _mm_mul_ps(far, _mm_set1_ps(1 + BVH_T_SLACK));
+    _mm_storeu_ps(t_near, near);
+    return _mm_movemask_ps(_mm_cmple_ps(near, far)) & (node.kinds | node.kinds >> 4);
+}
+#else
+static inline int hit_children(const BvhNode& node, const BoxRay& ray, f32 t_max, f32* t_near) {
+    int mask = 0;
+    for (int k = 0; k < BVH_WIDTH; k++) {
+        f32 near = 0;
+        f32 far = t_max;
+        for (int a = 0; a < 3; a++) {
+            f32 step = quantum(node.exponent[a]);
+            f32 t0 = (node.origin[a] + node.lo[a][k] * step - ray.origin[a]) * ray.inv[a];
+            f32 t1 = (node.origin[a] + node.hi[a][k] * step - ray.origin[a]) * ray.inv[a];
+            near = fmaxf(near, fminf(t0, t1));
+            far = fminf(far, fmaxf(t0, t1));
+        }
+        t_near[k] = near * (1 - BVH_T_SLACK);
+        if (t_near[k] <= far * (1 + BVH_T_SLACK)) mask |= 1 << k;
+    }
+    return mask & (node.kinds | node.kinds >> 4);
+}
+#endif
+
+struct BvhStackEntry {
+    u32 ref;  // node index, or block offset with BVH_LEAF_REF
+    f32 t_near;
+};
+
+void bvh_index(Bvh& bvh, Arena& arena) {
+    bvh.triangle_blocks = arena.push_array<u32>(bvh.triangles_count);
+    for (size_t offset = 0; offset < bvh.blocks_size;) {
+        const u16* block = bvh.blocks + offset;
+        int count = block_count(block);
+        for (int i = 0; i < count; i++) bvh.triangle_blocks[read_u32(block + block_size(i))] = (u32) offset;
+        offset += block_size(count);
+    }
+}
+
+Triangle bvh_triangle(const Bvh& bvh, int id) {
+    const u16* block = bvh.blocks + bvh.triangle_blocks[id];
+    u32 base = read_u32(block) >> 4;
+    int i = 0;
+    while ((int) read_u32(block + block_size(i)) != id) i++;
+    const u16* triangle = block + block_size(i);
+    return Triangle {
+        .a = bvh.vertices[base + triangle[2]],
+        .b = bvh.vertices[base + triangle[3]],
+        .c = bvh.vertices[base + triangle[4]]
+    };
+}
+
+int bvh_trace(const Bvh& bvh, const Ray& ray, f64 best_t, int best_id, TraceStats* stats) {
+    if (bvh.triangles_count == 0) return best_id;
+
+    BoxRay box_ray;
+    f64 origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+    f64 direction[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+    for (int a = 0; a < 3; a++) {
+        box_ray.origin[a] = (f32) origin[a];
+        box_ray.inv[a] = (f32) fmax(-BVH_MAX_INV, fmin(BVH_MAX_INV, 1 / direction[a]));
+    }
+
+    f32 t_max = (f32) best_t;
+    i64 tested = 0;
+    i64 culled = 0;
+
+    BvhStackEntry stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = BvhStackEntry { .ref = 0, .t_near = 0 };
+    while (top > 0) {
+        BvhStackEntry entry = stack[--top];
+        if (entry.t_near > t_max) continue;
+
+        if (entry.ref & BVH_LEAF_REF) {
+            const u16* block = bvh.blocks + (entry.ref & ~BVH_LEAF_REF);
+            u32 base = read_u32(block) >> 4;
+            int count = block_count(block);
+            tested += count;
+            for (int i = 0; i < count; i++) {
+                const u16* triangle = block + block_size(i);
+                int id = (int) read_u32(triangle);
+                Triangle tri = {
+                    .a = bvh.vertices[base + triangle[2]],
+                    .b = bvh.vertices[base + triangle[3]],
+                    .c = bvh.vertices[base + triangle[4]]
+                };
+                Vec3 n = triangle_normal(tri);
+                f64 t = hit_plane(tri, n, ray);
+                if (t <= 0) continue;
+                if (!closer_hit(t, id, best_t, best_id)) {
+                    culled++;
+                    continue;
+                }
+                if (inside_triangle(tri, n, ray, t)) {
+                    best_t = t;
+                    best_id = id;
+                    t_max = (f32) best_t;
+                }
+            }
+            continue;
+        }
+
+        const BvhNode& node = bvh.nodes[entry.ref];
+        f32 t_near[BVH_WIDTH];
+        int mask = hit_children(node, box_ray, t_max, t_near);
+
+        // Pushed farthest first, so the nearest child is visited next.
+        BvhStackEntry hits[BVH_WIDTH];
+        int count = 0;
+        u32 next = node.first_node;
+        u32 block = node.first_block;
+        for (int k = 0; k < BVH_WIDTH; k++) {
+            u32 ref;
+            if (node.kinds & 1 << k) {
+                ref = BVH_LEAF_REF | block;
+                block += block_size(block_count(bvh.blocks + block));
+            } else if (node.kinds & 16 << k) {
+                ref = next++;
+            } else {
+                break;
+            }
+            if (!(mask & 1 << k)) continue;
+
+            int i = count++;
+            while (i > 0 && hits[i - 1].t_near > t_near[k]) {
+                hits[i] = hits[i - 1];
+                i--;
+            }
+            hits[i] = BvhStackEntry { .ref = ref, .t_near = t_near[k] };
+        }
+        for (int i = count - 1; i >= 0; i--) stack[top++] = hits[i];
+    }
+    if (stats != NULL) {
+        stats->rays++;
+        stats->triangles += tested;
+        stats->culled += culled;
+    }
+    return best_id;
+}
+
+size_t Bvh::bytes() const {
+    size_t vertex_bytes = sizeof(Vec3) * vertices_count * (rest != vertices ? 2 : 1);
+    return sizeof(BvhNode) * nodes_count + sizeof(u16) * blocks_size + vertex_bytes;
+}
+
+void Bvh::fprint_stats(FILE* f) const {
+    f64 n = triangles_count > 0 ? triangles_count : 1;
+    size_t vertex_bytes = sizeof(Vec3) * vertices_count * (rest != vertices ? 2 : 1);
+    fprintf(
+        f,
+        "Hierarchy: %d nodes, %d leaves, %.1f bytes per triangle (nodes %.1f, triangle blocks %.1f, vertices %.1f)\n",
+        nodes_count,
+        leaves_count,
+        bytes() / n,
+        sizeof(BvhNode) * nodes_count / n,
+        sizeof(u16) * blocks_size / n,
+        vertex_bytes / n
+    );
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdio.h>
+#include "common.h"
+#include "obj.h"
+#include "arena.h"
+#include "render.h"
+
+const int BVH_WIDTH = 4;
+const int BVH_LEAF_SIZE = 8;  // most triangles in a leaf, at most 15
+
+// Node of a four-wide hierarchy, 48 bytes. Child boxes are stored as 8-bit
+// steps of 2^exponent from the node's origin, rounded outwards, so all four
+// decode and test together in one SIMD step. Children that are nodes follow
+// each other in the node array, and children that are leaves have their
+// triangle blocks next to each other in the block stream.
+struct BvhNode {
+    f32 origin[3];
+    i8 exponent[3];
+    u8 kinds;                 // bit k: child k is a leaf, bit 4 + k: child k is a node
+    u8 lo[3][BVH_WIDTH];
+    u8 hi[3][BVH_WIDTH];
+    u32 first_node;
+    u32 first_block;
+};
+
+// Bounding volume hierarchy over a mesh in about 27 bytes per triangle for
+// a closed mesh: the nodes, the vertices and a stream of u16 triangle blocks,
+// one per leaf. A block starts with the leaf's vertex base and triangle
+// count packed in 32 bits (28 and 4), followed by each triangle's 32-bit id
+// and its corners as 16-bit offsets from the base. Vertices keep full
+// precision, so hits are the same as through the triangle arrays.
+struct Bvh {
+    int triangles_count;
+    int vertices_count;
+    int nodes_count;
+    int leaves_count;
+    size_t blocks_size;  // in u16
+    BvhNode* nodes;
+    u16* blocks;
+    Vec3* vertices;      // posed
+    Vec3* rest;          // as loaded, the same array as `vertices` if never posed
+    u32* triangle_blocks;  // block of each triangle by id, NULL until `bvh_index`
+    Vec3 center;         // of the mesh's bounding box, the turntable's axis
+
+    size_t bytes() const;
+    void fprint_stats(FILE* f) const;
+};
+
+// Builds the hierarchy in `arena` by splitting the faces along a Morton
+// curve through their centroids. Hits report a face by its index in the
+// mesh. With `posable` the loaded vertices are kept for `bvh_pose`, which
+// costs 24 more bytes per vertex.
+Bvh* bvh_create(const Obj::Mesh& mesh, bool posable, Arena& arena, Arena& scratch);
+
+// Turntable rotation like `pose_scene`, the node bounds are refit to the
+// moved triangles without changing the tree.
+void bvh_pose(Bvh& bvh, f64 angle);
+
+// Looks up the block of every triangle, for `bvh_triangle`. Costs 4 bytes
+// per triangle.
+void bvh_index(Bvh& bvh, Arena& arena);
+
+// Triangle with the given id, as posed. Needs `bvh_index`.
+Triangle bvh_triangle(const Bvh& bvh, int id);
+
+// Id of the closest triangle hit by the ray or -1, the same as
+// `trace_ray_bounded` over the triangles in id order. Boxes and triangles
+// beyond a known hit `best_id` at `best_t` (-1 and F64_INF for none) are
+// skipped. `stats` may be NULL.
+int bvh_trace(const Bvh& bvh, const Ray& ray, f64 best_t, int best_id, TraceStats* stats);
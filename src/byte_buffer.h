@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+
+// Growable byte array used as the output of the image encoders.
+struct ByteBuffer {
+    u8* data;
+    size_t size;
+    size_t capacity;
+
+    void reserve(size_t n) {
+        if (n <= capacity) return;
+        size_t new_capacity = capacity > 0 ? capacity : 256;
+        while (new_capacity < n) new_capacity *= 2;
+        data = (u8*) realloc(data, new_capacity);
+        capacity = new_capacity;
+    }
+
+    void push(u8 byte) {
+        if (size == capacity) reserve(size + 1);
+        data[size++] = byte;
+    }
+
+    void append(const u8* bytes, size_t n) {
+        reserve(size + n);
+        memcpy(data + size, bytes, n);
+        size += n;
+    }
+
+    void push_u32_be(u32 v) {
+        push((u8)(v >> 24));
+        push((u8)(v >> 16));
+        push((u8)(v >> 8));
+        push((u8) v);
+    }
+
+    void clear() { size = 0; }
+
+    void release() {
+        free(data);
+        data = NULL;
+        size = 0;
+        capacity = 0;
+    }
+};
@@ -8,6 +8,20 @@ static void set_default_cmd_args(CmdArgs& args) {
     args.threads = 1;
     args.height = 480;
     args.width = 640;
+    args.band_height = 0;
+    args.bands_in_flight = 0;
+    args.processes = 0;
+    args.worker = false;
+    args.frames = 1;
+    args.turntable = 0;
+    args.camera_nudge = Vec3 {};
+    args.hit_cache = false;
+    args.raster = false;
+    args.trace = false;
+    args.heatmap = false;
+    args.lod_pixels = 0;
+    args.perf = false;
+    args.bvh = false;
 }
 
 enum PresetType {
@@ -73,7 +87,7 @@ bool parse_cmd_args(int argc, char* argv[], CmdArgs& args) {
     bool preset_set = false;
     bool out_file_set = false;
 
-    while ((c = getopt(argc, argv, "h:w:n:o:p:")) != -1) {
+    while ((c = getopt(argc, argv, "h:w:n:o:p:s:b:j:Wf:t:d:crTHl:Pa")) != -1) {
         switch (c) {
         case 'h': {
             char* end;
@@ -108,6 +122,100 @@ bool parse_cmd_args(int argc, char* argv[], CmdArgs& args) {
             }
             break;
         }
+        case 's': {
+            char* end;
+            long num = strtol(optarg, &end, 10);
+            if (num <= 0) {
+                errors++;
+                fprintf(stderr, "Invalid band height: %ld\n", num);
+            } else {
+                args.band_height = (int) num;
+            }
+            break;
+        }
+        case 'b': {
+            char* end;
+            long num = strtol(optarg, &end, 10);
+            if (num <= 0) {
+                errors++;
+                fprintf(stderr, "Invalid number of bands in flight: %ld\n", num);
+            } else {
+                args.bands_in_flight = (int) num;
+            }
+            break;
+        }
+        case 'j': {
+            char* end;
+            long num = strtol(optarg, &end, 10);
+            if (num <= 0) {
+                errors++;
+                fprintf(stderr, "Invalid number of worker processes: %ld\n", num);
+            } else {
+                args.processes = (int) num;
+            }
+            break;
+        }
+        case 'W':
+            args.worker = true;
+            break;
+        case 'f': {
+            char* end;
+            long num = strtol(optarg, &end, 10);
+            if (num <= 0) {
+                errors++;
+                fprintf(stderr, "Invalid number of frames: %ld\n", num);
+            } else {
+                args.frames = (int) num;
+            }
+            break;
+        }
+        case 't': {
+            char* end;
+            args.turntable = strtod(optarg, &end);
+            if (end == optarg || *end != '\0') {
+                errors++;
+                fprintf(stderr, "Invalid turntable angle: \"%s\"\n", optarg);
+            }
+            break;
+        }
+        case 'd': {
+            Vec3& v = args.camera_nudge;
+            char rest;
+            if (sscanf(optarg, "%lf,%lf,%lf%c", &v.x, &v.y, &v.z, &rest) != 3) {
+                errors++;
+                fprintf(stderr, "Invalid camera nudge, expected x,y,z: \"%s\"\n", optarg);
+            }
+            break;
+        }
+        case 'c':
+            args.hit_cache = true;
+            break;
+        case 'r':
+            args.raster = true;
+            break;
+        case 'T':
+            args.trace = true;
+            break;
+        case 'H':
+            args.heatmap = true;
+            break;
+        case 'P':
+            args.perf = true;
+            break;
+        case 'a':
+            args.bvh = true;
+            break;
+        case 'l': {
+            char* end;
+            f64 num = strtod(optarg, &end);
+            if (end == optarg || *end != '\0' || !(num > 0)) {
+                errors++;
+                fprintf(stderr, "Invalid level of detail error: \"%s\"\n", optarg);
+            } else {
+                args.lod_pixels = num;
+            }
+            break;
+        }
         case 'o': {
             if (strlen(optarg) > CMD_MAX_OUT_FILE_NAME_LEN) {
                 errors++;
@@ -133,6 +241,36 @@ bool parse_cmd_args(int argc, char* argv[], CmdArgs& args) {
         }
     }
 
+    if (args.bands_in_flight == 0) {
+        args.bands_in_flight = 2 * args.threads;
+    }
+
+    if (args.processes > 0 && args.band_height > 0) {
+        errors++;
+        fprintf(stderr, "Streaming can't be combined with worker processes.\n");
+    }
+
+    bool sequence = args.frames > 1 || args.hit_cache;
+    if (sequence && (args.processes > 0 || args.band_height > 0)) {
+        errors++;
+        fprintf(stderr, "Frame sequences and the hit cache can't be combined with streaming or worker processes.\n");
+    }
+
+    if (args.raster && (args.processes > 0 || args.band_height > 0 || args.hit_cache)) {
+        errors++;
+        fprintf(stderr, "Rasterization can't be combined with streaming, worker processes or the hit cache.\n");
+    }
+
+    if (args.bvh && args.raster) {
+        errors++;
+        fprintf(stderr, "The hierarchy can't be combined with rasterization.\n");
+    }
+
+    if (args.heatmap && (args.processes > 0 || args.band_height > 0)) {
+        errors++;
+        fprintf(stderr, "The heatmap can't be combined with streaming or worker processes.\n");
+    }
+
     if (!out_file_set) {
         fprintf(stderr, "Out file not specified.\n");
     }
@@ -148,7 +286,31 @@ bool parse_cmd_args(int argc, char* argv[], CmdArgs& args) {
             stderr,
             (
                 "Usage:\n"
-                "   TODO :)\n"
+                "   rt -p <preset> -o <file> [options]\n"
+                "\n"
+                "   -p <preset>   mesh and camera: teddy-bear, teapot or cube\n"
+                "   -o <file>     output image, PNG or QOI by its extension, plain text PPM\n"
+                "                 otherwise\n"
+                "   -w <pixels>   image width, 640 by default\n"
+                "   -h <pixels>   image height, 480 by default\n"
+                "   -n <threads>  render threads, 1 by default\n"
+                "   -s <rows>     render and write the image in bands of <rows> rows. PNG and\n"
+                "                 QOI encoding overlaps rendering only in this mode; without\n"
+                "                 it the frame is encoded after all of it is rendered.\n"
+                "   -b <bands>    bands held in memory at once with -s, twice the threads by\n"
+                "                 default\n"
+                "   -j <count>    render tiles in <count> worker processes\n"
+                "   -W            serve tiles to a coordinator on stdin and stdout, used by -j\n"
+                "   -f <frames>   render a sequence of frames, numbered in the file names\n"
+                "   -t <degrees>  turn the mesh by <degrees> per frame\n"
+                "   -d <x,y,z>    move the camera by <x,y,z> per frame\n"
+                "   -c            test each pixel's hit from the previous frame first\n"
+                "   -r            rasterize primary visibility instead of casting rays\n"
+                "   -a            trace through a compressed bounding volume hierarchy\n"
+                "   -l <pixels>   simplify the mesh as far as an error of <pixels> allows\n"
+                "   -T            write a Chrome trace to <file>.trace.json\n"
+                "   -H            write a per pixel cost heatmap to <file>.heat.ppm\n"
+                "   -P            count cache misses and instructions while rendering\n"
             )
         );
     }
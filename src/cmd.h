@@ -9,6 +9,20 @@ struct CmdArgs {
     int threads;
     int height;
     int width;
+    int band_height;      // rows per band in streaming mode, 0 when disabled
+    int bands_in_flight;  // max bands held in memory in streaming mode
+    int processes;        // worker processes in distributed mode, 0 when disabled
+    bool worker;          // serve tiles to a coordinator on stdin/stdout
+    int frames;           // frames in the sequence, numbered in the out file name when > 1
+    f64 turntable;        // mesh rotation per frame, in degrees
+    Vec3 camera_nudge;    // camera movement per frame
+    bool hit_cache;       // reuse the previous frame's hits
+    bool raster;          // rasterize primary visibility instead of casting rays
+    bool trace;           // write a Chrome trace next to the out file
+    bool heatmap;         // write a per pixel cost image next to the out file
+    f64 lod_pixels;       // allowed simplification error in pixels, 0 when disabled
+    bool perf;            // count cache misses while rendering
+    bool bvh;             // trace through a compressed hierarchy instead of every triangle
 
     char in_file_name[CMD_MAX_IN_FILE_NAME_LEN+1];
     char out_file_name[CMD_MAX_OUT_FILE_NAME_LEN+1];
@@ -1,10 +1,18 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
 
+using f32 = float;
 using f64 = double;
+using i8  = int8_t;
 using i32 = int32_t;
+using i64 = int64_t;
 using u8  = uint8_t;
+using u16 = uint16_t;
+using u32 = uint32_t;
+using u64 = uint64_t;
 
 const f64 F64_INF = 1.0 / 0.0;
 
@@ -30,3 +38,23 @@ inline void sleep_ms(int milliseconds){ // cross-platform sleep function
     usleep((milliseconds % 1000) * 1000);
 #endif
 }
+
+inline f64 now_seconds() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Monotonic clock for measuring short intervals.
+inline i64 now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (i64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// CPU time of the calling thread, which doesn't count waiting for a core.
+inline i64 thread_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (i64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
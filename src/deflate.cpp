@@ -0,0 +1,481 @@
+#include <stdlib.h>
+#include <string.h>
+#include "deflate.h"
+
+static const int WINDOW_SIZE = 1 << 15;
+static const int MIN_MATCH = 3;
+static const int MAX_MATCH = 258;
+static const int HASH_BITS = 15;
+static const int HASH_SIZE = 1 << HASH_BITS;
+static const int MAX_CHAIN = 64;
+static const int BLOCK_TOKENS = 1 << 16;
+static const int MAX_STORED = 0xffff;
+
+static const int LIT_CODES = 286;
+static const int DIST_CODES = 30;
+static const int CODE_LENGTH_CODES = 19;
+static const int MAX_BITS = 15;
+static const int MAX_CODE_LENGTH_BITS = 7;
+static const int END_OF_BLOCK = 256;
+
+static const u16 LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const u8 LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const u16 DIST_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const u8 DIST_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const u8 CODE_LENGTH_ORDER[CODE_LENGTH_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+struct Token {
+    u16 length;    // literal byte when distance is 0
+    u16 distance;
+};
+
+struct BitWriter {
+    ByteBuffer* out;
+    u64 bits;
+    int count;
+
+    void put(u32 value, int n) {
+        bits |= (u64) value << count;
+        count += n;
+        while (count >= 8) {
+            out->push((u8) bits);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    void align() {
+        if (count > 0) {
+            out->push((u8) bits);
+            bits = 0;
+            count = 0;
+        }
+    }
+};
+
+static int length_code(int length) {
+    int code = 28;
+    while (length < LENGTH_BASE[code]) code--;
+    return code;
+}
+
+static int distance_code(int distance) {
+    int code = 29;
+    while (distance < DIST_BASE[code]) code--;
+    return code;
+}
+
+static u32 reverse_bits(u32 code, int n) {
+    u32 result = 0;
+    for (int i = 0; i < n; i++) {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+    return result;
+}
+
+// Huffman code lengths limited to `max_bits`. At least two symbols have to
+// be used, so that the code is complete.
+static void huffman_lengths(const u32* freqs, int n, int max_bits, u8* lengths) {
+    int symbols[LIT_CODES];
+    int used = 0;
+    for (int i = 0; i < n; i++) {
+        lengths[i] = 0;
+        if (freqs[i] > 0) symbols[used++] = i;
+    }
+
+    // Insertion sort by frequency, the alphabets are small.
+    for (int i = 1; i < used; i++) {
+        int s = symbols[i];
+        int j = i;
+        while (j > 0 && freqs[symbols[j-1]] > freqs[s]) {
+            symbols[j] = symbols[j-1];
+            j--;
+        }
+        symbols[j] = s;
+    }
+
+    // Two-queue Huffman construction: leaves are taken from the sorted
+    // symbols and internal nodes are created in non-decreasing weight order.
+    u32 weight[2 * LIT_CODES];
+    int parent[2 * LIT_CODES];
+    int depth[2 * LIT_CODES];
+    for (int i = 0; i < used; i++) weight[i] = freqs[symbols[i]];
+    int leaf = 0;
+    int internal = used;
+    int next = used;
+    while (next < 2 * used - 1) {
+        int pair[2];
+        for (int k = 0; k < 2; k++) {
+            if (leaf < used && (internal >= next || weight[leaf] <= weight[internal])) {
+                pair[k] = leaf++;
+            } else {
+                pair[k] = internal++;
+            }
+        }
+        weight[next] = weight[pair[0]] + weight[pair[1]];
+        parent[pair[0]] = next;
+        parent[pair[1]] = next;
+        next++;
+    }
+    depth[2 * used - 2] = 0;
+    for (int i = 2 * used - 3; i >= 0; i--) depth[i] = depth[parent[i]] + 1;
+
+    int bl_count[MAX_BITS + 1] = {0};
+    for (int i = 0; i < used; i++) {
+        int d = depth[i] > max_bits ? max_bits : depth[i];
+        bl_count[d]++;
+    }
+
+    // Clamping made the code over-subscribed, move leaves down the tree
+    // until the Kraft sum is exactly one again.
+    u32 total = 0;
+    for (int i = 1; i <= max_bits; i++) total += (u32) bl_count[i] << (max_bits - i);
+    while (total != (1u << max_bits)) {
+        bl_count[max_bits]--;
+        for (int i = max_bits - 1; i > 0; i--) {
+            if (bl_count[i] > 0) {
+                bl_count[i]--;
+                bl_count[i + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // The least frequent symbols get the longest codes.
+    int s = 0;
+    for (int len = max_bits; len > 0; len--) {
+        for (int k = 0; k < bl_count[len]; k++) {
+            lengths[symbols[s++]] = len;
+        }
+    }
+}
+
+static void huffman_codes(const u8* lengths, int n, u32* codes) {
+    int bl_count[MAX_BITS + 1] = {0};
+    for (int i = 0; i < n; i++) bl_count[lengths[i]]++;
+    bl_count[0] = 0;
+
+    u32 next_code[MAX_BITS + 1];
+    u32 code = 0;
+    for (int bits = 1; bits <= MAX_BITS; bits++) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        if (lengths[i] > 0) {
+            codes[i] = reverse_bits(next_code[lengths[i]]++, lengths[i]);
+        }
+    }
+}
+
+static void ensure_two_codes(u32* freqs, int n) {
+    int used = 0;
+    for (int i = 0; i < n; i++) {
+        if (freqs[i] > 0) used++;
+    }
+    for (int i = 0; used < 2 && i < n; i++) {
+        if (freqs[i] == 0) {
+            freqs[i] = 1;
+            used++;
+        }
+    }
+}
+
+struct CodeLengthSymbol {
+    u8 symbol;
+    u8 extra;
+};
+
+// Run-length encodes the literal and distance code lengths with the
+// repeat symbols 16, 17 and 18.
+static int encode_code_lengths(const u8* lengths, int n, CodeLengthSymbol* out) {
+    int count = 0;
+    int i = 0;
+    while (i < n) {
+        u8 len = lengths[i];
+        int run = 1;
+        while (i + run < n && lengths[i + run] == len) run++;
+
+        if (len == 0) {
+            while (run >= 11) {
+                int r = run < 138 ? run : 138;
+                out[count++] = CodeLengthSymbol { .symbol = 18, .extra = (u8)(r - 11) };
+                run -= r;
+                i += r;
+            }
+            if (run >= 3) {
+                out[count++] = CodeLengthSymbol { .symbol = 17, .extra = (u8)(run - 3) };
+                i += run;
+                run = 0;
+            }
+        } else {
+            out[count++] = CodeLengthSymbol { .symbol = len, .extra = 0 };
+            run--;
+            i++;
+            while (run >= 3) {
+                int r = run < 6 ? run : 6;
+                out[count++] = CodeLengthSymbol { .symbol = 16, .extra = (u8)(r - 3) };
+                run -= r;
+                i += r;
+            }
+        }
+        for (; run > 0; run--) {
+            out[count++] = CodeLengthSymbol { .symbol = len, .extra = 0 };
+            i++;
+        }
+    }
+    return count;
+}
+
+// Stored blocks of at most MAX_STORED bytes each, at least one even when
+// `size` is 0.
+static void write_stored(BitWriter& w, const u8* data, size_t size) {
+    do {
+        size_t n = size < (size_t) MAX_STORED ? size : MAX_STORED;
+        w.put(0, 1);  // BFINAL
+        w.put(0, 2);  // BTYPE: stored
+        w.align();
+        w.out->push((u8) n);
+        w.out->push((u8) (n >> 8));
+        w.out->push((u8) ~n);
+        w.out->push((u8) (~n >> 8));
+        if (n > 0) w.out->append(data, n);
+        data += n;
+        size -= n;
+    } while (size > 0);
+}
+
+// Writes the tokens as a dynamic Huffman block, or the `raw` bytes they
+// encode as stored blocks when that is smaller (incompressible data).
+static void write_block(BitWriter& w, const Token* tokens, int tokens_count, const u8* raw, size_t raw_size) {
+    u32 lit_freq[LIT_CODES] = {0};
+    u32 dist_freq[DIST_CODES] = {0};
+    for (int i = 0; i < tokens_count; i++) {
+        if (tokens[i].distance == 0) {
+            lit_freq[tokens[i].length]++;
+        } else {
+            lit_freq[257 + length_code(tokens[i].length)]++;
+            dist_freq[distance_code(tokens[i].distance)]++;
+        }
+    }
+    lit_freq[END_OF_BLOCK] = 1;
+    ensure_two_codes(lit_freq, LIT_CODES);
+    ensure_two_codes(dist_freq, DIST_CODES);
+
+    u8 lit_len[LIT_CODES];
+    u8 dist_len[DIST_CODES];
+    huffman_lengths(lit_freq, LIT_CODES, MAX_BITS, lit_len);
+    huffman_lengths(dist_freq, DIST_CODES, MAX_BITS, dist_len);
+
+    int hlit = LIT_CODES;
+    while (hlit > 257 && lit_len[hlit - 1] == 0) hlit--;
+    int hdist = DIST_CODES;
+    while (hdist > 1 && dist_len[hdist - 1] == 0) hdist--;
+    u8 lengths[LIT_CODES + DIST_CODES];
+    memcpy(lengths, lit_len, hlit);
+    memcpy(lengths + hlit, dist_len, hdist);
+
+    CodeLengthSymbol cl_symbols[LIT_CODES + DIST_CODES];
+    int cl_count = encode_code_lengths(lengths, hlit + hdist, cl_symbols);
+    u32 cl_freq[CODE_LENGTH_CODES] = {0};
+    for (int i = 0; i < cl_count; i++) cl_freq[cl_symbols[i].symbol]++;
+    ensure_two_codes(cl_freq, CODE_LENGTH_CODES);
+    u8 cl_len[CODE_LENGTH_CODES];
+    huffman_lengths(cl_freq, CODE_LENGTH_CODES, MAX_CODE_LENGTH_BITS, cl_len);
+    int hclen = CODE_LENGTH_CODES;
+    while (hclen > 4 && cl_len[CODE_LENGTH_ORDER[hclen - 1]] == 0) hclen--;
+
+    u32 lit_codes[LIT_CODES];
+    u32 dist_codes[DIST_CODES];
+    u32 cl_codes[CODE_LENGTH_CODES];
+    huffman_codes(lit_len, LIT_CODES, lit_codes);
+    huffman_codes(dist_len, DIST_CODES, dist_codes);
+    huffman_codes(cl_len, CODE_LENGTH_CODES, cl_codes);
+
+    u64 dynamic_bits = 3 + 5 + 5 + 4 + 3 * hclen + lit_len[END_OF_BLOCK];
+    for (int i = 0; i < cl_count; i++) {
+        u8 symbol = cl_symbols[i].symbol;
+        dynamic_bits += cl_len[symbol] + (symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0);
+    }
+    for (int i = 0; i < tokens_count; i++) {
+        Token token = tokens[i];
+        if (token.distance == 0) {
+            dynamic_bits += lit_len[token.length];
+        } else {
+            int lc = length_code(token.length);
+            int dc = distance_code(token.distance);
+            dynamic_bits += lit_len[257 + lc] + LENGTH_EXTRA[lc] + dist_len[dc] + DIST_EXTRA[dc];
+        }
+    }
+    // Header, alignment, LEN and NLEN of each stored block.
+    u64 stored_blocks = (raw_size + MAX_STORED - 1) / MAX_STORED;
+    u64 stored_bits = 8 * (raw_size + 5 * stored_blocks);
+    if (dynamic_bits > stored_bits) {
+        write_stored(w, raw, raw_size);
+        return;
+    }
+
+    w.put(0, 1);  // BFINAL
+    w.put(2, 2);  // BTYPE: dynamic Huffman codes
+    w.put(hlit - 257, 5);
+    w.put(hdist - 1, 5);
+    w.put(hclen - 4, 4);
+    for (int i = 0; i < hclen; i++) {
+        w.put(cl_len[CODE_LENGTH_ORDER[i]], 3);
+    }
+    for (int i = 0; i < cl_count; i++) {
+        u8 symbol = cl_symbols[i].symbol;
+        w.put(cl_codes[symbol], cl_len[symbol]);
+        if (symbol == 16) w.put(cl_symbols[i].extra, 2);
+        else if (symbol == 17) w.put(cl_symbols[i].extra, 3);
+        else if (symbol == 18) w.put(cl_symbols[i].extra, 7);
+    }
+
+    for (int i = 0; i < tokens_count; i++) {
+        Token token = tokens[i];
+        if (token.distance == 0) {
+            w.put(lit_codes[token.length], lit_len[token.length]);
+        } else {
+            int lc = length_code(token.length);
+            w.put(lit_codes[257 + lc], lit_len[257 + lc]);
+            w.put(token.length - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+            int dc = distance_code(token.distance);
+            w.put(dist_codes[dc], dist_len[dc]);
+            w.put(token.distance - DIST_BASE[dc], DIST_EXTRA[dc]);
+        }
+    }
+    w.put(lit_codes[END_OF_BLOCK], lit_len[END_OF_BLOCK]);
+}
+
+static inline u32 hash3(const u8* p) {
+    u32 v = (u32) p[0] << 16 | (u32) p[1] << 8 | p[2];
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+struct Deflater {
+    Token* tokens;
+    i32* head;
+    i32* prev;
+};
+
+Deflater* deflater_create(Arena& arena) {
+    Deflater* deflater = arena.push_array<Deflater>(1);
+    *deflater = Deflater {
+        .tokens = arena.push_array<Token>(BLOCK_TOKENS),
+        .head = arena.push_array<i32>(HASH_SIZE),
+        .prev = arena.push_array<i32>(WINDOW_SIZE)
+    };
+    return deflater;
+}
+
+void deflate_chunk(Deflater& deflater, const u8* data, size_t size, ByteBuffer& out) {
+    BitWriter w = { .out = &out, .bits = 0, .count = 0 };
+    Token* tokens = deflater.tokens;
+    i32* head = deflater.head;
+    i32* prev = deflater.prev;
+    for (int i = 0; i < HASH_SIZE; i++) head[i] = -1;
+
+    int tokens_count = 0;
+    i32 block_start = 0;
+    i32 pos = 0;
+    i32 end = (i32) size;
+    while (pos < end) {
+        int best_len = 0;
+        int best_dist = 0;
+        if (pos + MIN_MATCH <= end) {
+            int max_len = end - pos < MAX_MATCH ? end - pos : MAX_MATCH;
+            u32 h = hash3(data + pos);
+            i32 candidate = head[h];
+            int chain = MAX_CHAIN;
+            while (candidate >= 0 && pos - candidate <= WINDOW_SIZE && chain-- > 0) {
+                const u8* a = data + candidate;
+                const u8* b = data + pos;
+                if (a[best_len] == b[best_len]) {
+                    int len = 0;
+                    while (len < max_len && a[len] == b[len]) len++;
+                    if (len > best_len) {
+                        best_len = len;
+                        best_dist = pos - candidate;
+                        if (len == max_len) break;
+                    }
+                }
+                candidate = prev[candidate & (WINDOW_SIZE - 1)];
+            }
+            prev[pos & (WINDOW_SIZE - 1)] = head[h];
+            head[h] = pos;
+        }
+
+        if (best_len >= MIN_MATCH) {
+            tokens[tokens_count++] = Token { .length = (u16) best_len, .distance = (u16) best_dist };
+            for (i32 i = pos + 1; i < pos + best_len && i + MIN_MATCH <= end; i++) {
+                u32 h = hash3(data + i);
+                prev[i & (WINDOW_SIZE - 1)] = head[h];
+                head[h] = i;
+            }
+            pos += best_len;
+        } else {
+            tokens[tokens_count++] = Token { .length = data[pos], .distance = 0 };
+            pos++;
+        }
+
+        if (tokens_count == BLOCK_TOKENS) {
+            write_block(w, tokens, tokens_count, data + block_start, pos - block_start);
+            tokens_count = 0;
+            block_start = pos;
+        }
+    }
+    if (tokens_count > 0) write_block(w, tokens, tokens_count, data + block_start, pos - block_start);
+
+    // Empty stored block, brings the stream back to a byte boundary.
+    write_stored(w, NULL, 0);
+}
+
+void deflate_finish(ByteBuffer& out) {
+    // Final empty block with fixed Huffman codes: BFINAL, BTYPE = 01 and
+    // the 7 bit end of block code.
+    out.push(0x03);
+    out.push(0x00);
+}
+
+static const u32 ADLER_BASE = 65521;
+
+u32 adler32(u32 adler, const u8* data, size_t size) {
+    u32 a = adler & 0xffff;
+    u32 b = adler >> 16;
+    while (size > 0) {
+        // Largest n for which b cannot overflow before the modulo.
+        size_t n = size < 5552 ? size : 5552;
+        size -= n;
+        while (n-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return (b << 16) | a;
+}
+
+u32 adler32_combine(u32 adler_a, u32 adler_b, size_t size_b) {
+    u64 rem = size_b % ADLER_BASE;
+    u64 a = (adler_a & 0xffff) + (adler_b & 0xffff) + ADLER_BASE - 1;
+    u64 b = rem * (adler_a & 0xffff) % ADLER_BASE;
+    b += (adler_a >> 16) + (adler_b >> 16) + ADLER_BASE - rem;
+    return (u32)((b % ADLER_BASE) << 16 | (a % ADLER_BASE));
+}
@@ -0,0 +1,25 @@
+// Deflate format documentation:
+//     https://www.rfc-editor.org/rfc/rfc1951
+
+#pragma once
+
+#include "common.h"
+#include "byte_buffer.h"
+#include "arena.h"
+
+struct Deflater;
+
+// Working memory of `deflate_chunk`: the hash chains and a block of tokens.
+// It can be reused for any number of chunks, by one thread at a time.
+Deflater* deflater_create(Arena& arena);
+
+// Compresses `size` bytes into deflate blocks appended to `out`. The blocks
+// are never final and end byte aligned (like zlib's Z_SYNC_FLUSH), so the
+// outputs of separate calls, compressed independently on different threads,
+// can be concatenated into one stream and closed with `deflate_finish`.
+void deflate_chunk(Deflater& deflater, const u8* data, size_t size, ByteBuffer& out);
+void deflate_finish(ByteBuffer& out);
+
+u32 adler32(u32 adler, const u8* data, size_t size);
+// Checksum of A+B given the checksums of A and B and the length of B.
+u32 adler32_combine(u32 adler_a, u32 adler_b, size_t size_b);
@@ -0,0 +1,446 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "dist.h"
+
+static const int TILE_SIZE = 64;
+static const u32 HELLO_MAGIC = 0x72747731;  // "rtw1"
+
+// Tiles that run this many times longer than the average are duplicated
+// onto idle workers.
+static const f64 SLOW_TILE_FACTOR = 4;
+static const f64 SLOW_TILE_MIN_SECONDS = 0.1;
+static const f64 SLOW_TILE_DEFAULT_SECONDS = 1;
+static const int POLL_TIMEOUT_MS = 50;
+// How long an idle worker gets to exit after its socket is closed.
+static const int WORKER_EXIT_GRACE_MS = 500;
+
+// Messages are sent in native byte order, both ends run the same binary.
+struct WorkerHello {
+    u32 magic;
+    i32 width;
+    i32 height;
+    i32 triangles;
+};
+
+struct TileRequest {
+    i32 tile;
+    i32 row;
+    i32 col;
+    i32 rows;
+    i32 cols;
+};
+
+struct TileResultHeader {
+    i32 tile;
+    i32 pixels;
+};
+
+static bool read_full(int fd, void* data, size_t size) {
+    u8* p = (u8*) data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void* data, size_t size) {
+    const u8* p = (const u8*) data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) {
+            struct pollfd pfd = { .fd = fd, .events = POLLOUT, .revents = 0 };
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+int run_worker(const Camera& camera, const Scene& scene, Arena& arena) {
+    signal(SIGPIPE, SIG_IGN);
+
+    WorkerHello hello = {
+        .magic = HELLO_MAGIC,
+        .width = camera.width,
+        .height = camera.height,
+        .triangles = scene.triangles_count
+    };
+    if (!write_full(1, &hello, sizeof(hello))) return 1;
+
+    i32* pixels = arena.push_array<i32>(TILE_SIZE * TILE_SIZE);
+    TileRequest request;
+    while (read_full(0, &request, sizeof(request))) {
+        TileResultHeader header = { .tile = request.tile, .pixels = request.rows * request.cols };
+        for (int row = 0; row < request.rows; row++) {
+            for (int col = 0; col < request.cols; col++) {
+                int hit = trace_ray(scene, camera.pixel_ray(request.row + row, request.col + col));
+                pixels[row * request.cols + col] = hit >= 0 ? get_rand_color(hit).mem : 0;
+            }
+        }
+        if (
+            !write_full(1, &header, sizeof(header)) ||
+            !write_full(1, pixels, sizeof(i32) * header.pixels)
+        ) {
+            break;
+        }
+    }
+    return 0;
+}
+
+struct Tile {
+    i32 row;
+    i32 col;
+    i32 rows;
+    i32 cols;
+    bool done;
+    int workers;       // workers currently rendering the tile
+    f64 started;       // when the first of them got it
+};
+
+struct WorkerProcess {
+    pid_t pid;
+    int fd;
+    bool alive;
+    bool ready;        // hello received
+    int tile;          // tile in progress, -1 when idle
+    f64 tile_started;
+    int tiles_done;
+
+    u8* inbox;
+    size_t inbox_size;
+};
+
+struct Coordinator {
+    const Camera* camera;
+    FrameBuffer* frame_buffer;
+    Counter* counter;
+
+    Tile* tiles;
+    int tiles_count;
+    int tiles_done;
+    int* queue;        // pending tiles, requeued ones are pushed at the front
+    int queue_begin;
+    int queue_end;
+
+    WorkerProcess* workers;
+    int workers_count;
+    int alive_count;
+
+    f64 tile_seconds;  // sum over finished tiles, for the average
+    int timed_tiles;
+    int duplicated_tiles;
+    int requeued_tiles;
+};
+
+static bool spawn_worker(WorkerProcess& worker, char** argv, u8* inbox) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return false;
+    // Only the worker's end should survive the exec.
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(sv[1], 0);
+        dup2(sv[1], 1);
+        close(sv[1]);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    close(sv[1]);
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    worker = WorkerProcess {
+        .pid = pid,
+        .fd = sv[0],
+        .alive = true,
+        .ready = false,
+        .tile = -1,
+        .tile_started = 0,
+        .tiles_done = 0,
+        .inbox = inbox,
+        .inbox_size = 0
+    };
+    return true;
+}
+
+static void requeue_tile(Coordinator& c, int tile) {
+    c.queue[--c.queue_begin] = tile;
+    c.requeued_tiles++;
+}
+
+static void drop_worker(Coordinator& c, WorkerProcess& worker) {
+    if (!worker.alive) return;
+    worker.alive = false;
+    c.alive_count--;
+    close(worker.fd);
+    kill(worker.pid, SIGKILL);
+    waitpid(worker.pid, NULL, 0);
+    if (worker.tile >= 0) {
+        Tile& tile = c.tiles[worker.tile];
+        tile.workers--;
+        if (!tile.done && tile.workers == 0) requeue_tile(c, worker.tile);
+        worker.tile = -1;
+    }
+    fprintf(stderr, "\nWorker %d stopped responding, its work is reassigned\n", (int) worker.pid);
+}
+
+// Closing the socket makes an idle worker exit. One still busy with a
+// duplicated tile isn't waited for, and one that doesn't exit in time (e.g.
+// it was stopped) is killed, so shutdown never blocks on a worker. Returns
+// whether the worker exited on its own.
+static bool reap_worker(WorkerProcess& worker) {
+    close(worker.fd);
+    if (worker.tile >= 0) kill(worker.pid, SIGKILL);
+    int status;
+    for (int waited = 0; waitpid(worker.pid, &status, WNOHANG) == 0; waited += 10) {
+        if (waited >= WORKER_EXIT_GRACE_MS) {
+            kill(worker.pid, SIGKILL);
+            waitpid(worker.pid, NULL, 0);
+            return false;
+        }
+        sleep_ms(10);
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static f64 slow_tile_seconds(Coordinator& c) {
+    if (c.timed_tiles == 0) return SLOW_TILE_DEFAULT_SECONDS;
+    f64 slow = SLOW_TILE_FACTOR * c.tile_seconds / c.timed_tiles;
+    return slow > SLOW_TILE_MIN_SECONDS ? slow : SLOW_TILE_MIN_SECONDS;
+}
+
+// Next tile for an idle worker: a pending one, or else the longest running
+// tile that is overdue and not already duplicated.
+static int next_tile(Coordinator& c) {
+    if (c.queue_begin < c.queue_end) return c.queue[c.queue_begin++];
+
+    f64 now = now_seconds();
+    f64 slow = slow_tile_seconds(c);
+    int best = -1;
+    for (int i = 0; i < c.workers_count; i++) {
+        WorkerProcess& w = c.workers[i];
+        if (!w.alive || w.tile < 0) continue;
+        Tile& tile = c.tiles[w.tile];
+        if (tile.done || tile.workers > 1 || now - tile.started < slow) continue;
+        if (best < 0 || tile.started < c.tiles[best].started) best = w.tile;
+    }
+    if (best >= 0) c.duplicated_tiles++;
+    return best;
+}
+
+static void assign_work(Coordinator& c) {
+    for (int i = 0; i < c.workers_count; i++) {
+        WorkerProcess& w = c.workers[i];
+        if (!w.alive || !w.ready || w.tile >= 0) continue;
+
+        int t = next_tile(c);
+        if (t < 0) return;
+        Tile& tile = c.tiles[t];
+        TileRequest request = {
+            .tile = t,
+            .row = tile.row,
+            .col = tile.col,
+            .rows = tile.rows,
+            .cols = tile.cols
+        };
+        w.tile = t;
+        w.tile_started = now_seconds();
+        if (tile.workers++ == 0) tile.started = w.tile_started;
+        if (!write_full(w.fd, &request, sizeof(request))) {
+            drop_worker(c, w);
+        }
+    }
+}
+
+static void finish_tile(Coordinator& c, WorkerProcess& w) {
+    TileResultHeader header;
+    memcpy(&header, w.inbox, sizeof(header));
+    Tile& tile = c.tiles[header.tile];
+    tile.workers--;
+    w.tile = -1;
+    w.tiles_done++;
+    c.tile_seconds += now_seconds() - w.tile_started;
+    c.timed_tiles++;
+    if (tile.done) return;  // a duplicate finished first
+
+    const i32* pixels = (const i32*)(w.inbox + sizeof(header));
+    for (int row = 0; row < tile.rows; row++) {
+        for (int col = 0; col < tile.cols; col++) {
+            RGB color;
+            color.mem = pixels[row * tile.cols + col];
+            c.frame_buffer->set(tile.row + row, tile.col + col, color);
+        }
+    }
+    tile.done = true;
+    c.tiles_done++;
+    c.counter->inc(tile.rows * tile.cols);
+}
+
+// Reads whatever the worker sent and handles every complete message.
+static void receive(Coordinator& c, WorkerProcess& w) {
+    while (w.alive) {
+        size_t expected = sizeof(WorkerHello);
+        if (w.ready) {
+            expected = sizeof(TileResultHeader);
+            if (w.inbox_size >= expected) {
+                TileResultHeader header;
+                memcpy(&header, w.inbox, sizeof(header));
+                if (
+                    w.tile < 0 ||
+                    header.tile != w.tile ||
+                    header.pixels != c.tiles[w.tile].rows * c.tiles[w.tile].cols
+                ) {
+                    drop_worker(c, w);
+                    return;
+                }
+                expected += sizeof(i32) * header.pixels;
+            }
+        }
+
+        if (w.inbox_size < expected) {
+            ssize_t n = read(w.fd, w.inbox + w.inbox_size, expected - w.inbox_size);
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+            if (n <= 0) {
+                drop_worker(c, w);
+                return;
+            }
+            w.inbox_size += n;
+            continue;
+        }
+
+        if (w.ready) {
+            finish_tile(c, w);
+        } else {
+            WorkerHello hello;
+            memcpy(&hello, w.inbox, sizeof(hello));
+            if (
+                hello.magic != HELLO_MAGIC ||
+                hello.width != c.camera->width ||
+                hello.height != c.camera->height
+            ) {
+                drop_worker(c, w);
+                return;
+            }
+            w.ready = true;
+        }
+        w.inbox_size = 0;
+    }
+}
+
+bool render_distributed(
+    const DistConfig& config,
+    const Camera& camera,
+    Counter* counter,
+    FrameBuffer& frame_buffer,
+    Arena& arena
+) {
+    signal(SIGPIPE, SIG_IGN);
+
+    int tile_rows = (camera.height + TILE_SIZE - 1) / TILE_SIZE;
+    int tile_cols = (camera.width + TILE_SIZE - 1) / TILE_SIZE;
+    Coordinator c = {};
+    c.camera = &camera;
+    c.frame_buffer = &frame_buffer;
+    c.counter = counter;
+    c.tiles_count = tile_rows * tile_cols;
+    c.tiles = arena.push_array<Tile>(c.tiles_count);
+    // A dying worker requeues at most one tile, leave room for that in
+    // front of the queue.
+    c.queue = arena.push_array<int>(c.tiles_count + config.processes);
+    c.queue_begin = config.processes;
+    c.queue_end = c.queue_begin;
+    for (int r = 0; r < tile_rows; r++) {
+        for (int col = 0; col < tile_cols; col++) {
+            int t = r * tile_cols + col;
+            c.tiles[t] = Tile {
+                .row = r * TILE_SIZE,
+                .col = col * TILE_SIZE,
+                .rows = r + 1 < tile_rows ? TILE_SIZE : camera.height - r * TILE_SIZE,
+                .cols = col + 1 < tile_cols ? TILE_SIZE : camera.width - col * TILE_SIZE,
+                .done = false,
+                .workers = 0,
+                .started = 0
+            };
+            c.queue[c.queue_end++] = t;
+        }
+    }
+
+    c.workers = arena.push_array_zero<WorkerProcess>(config.processes);
+    size_t inbox_size = sizeof(TileResultHeader) + sizeof(i32) * TILE_SIZE * TILE_SIZE;
+    u8* inboxes = arena.push_array<u8>(inbox_size * config.processes);
+    for (int i = 0; i < config.processes; i++) {
+        // Live workers are packed at the front, a failed spawn leaves no gap.
+        u8* inbox = inboxes + inbox_size * c.workers_count;
+        if (spawn_worker(c.workers[c.workers_count], config.worker_argv, inbox)) {
+            c.workers_count++;
+            c.alive_count++;
+        }
+    }
+
+    struct pollfd* fds = arena.push_array<struct pollfd>(config.processes);
+    int* fd_workers = arena.push_array<int>(config.processes);
+    while (c.tiles_done < c.tiles_count && c.alive_count > 0) {
+        assign_work(c);
+
+        int nfds = 0;
+        for (int i = 0; i < c.workers_count; i++) {
+            if (!c.workers[i].alive) continue;
+            fds[nfds] = { .fd = c.workers[i].fd, .events = POLLIN, .revents = 0 };
+            fd_workers[nfds++] = i;
+        }
+        if (poll(fds, nfds, POLL_TIMEOUT_MS) < 0 && errno != EINTR) break;
+        for (int i = 0; i < nfds; i++) {
+            if (fds[i].revents != 0) receive(c, c.workers[fd_workers[i]]);
+        }
+    }
+
+    bool ok = c.tiles_done == c.tiles_count;
+    if (!ok) fprintf(stderr, "\nAll workers failed, %d tiles not rendered\n", c.tiles_count - c.tiles_done);
+
+    int finished = 0;
+    int killed = 0;
+    for (int i = 0; i < c.workers_count; i++) {
+        if (!c.workers[i].alive) continue;
+        if (reap_worker(c.workers[i])) {
+            finished++;
+        } else {
+            killed++;
+        }
+    }
+
+    // Workers that never started or stopped responding during the render
+    // were dropped.
+    fprintf(
+        stderr,
+        "\nWorkers: %d of %d finished, %d killed at shutdown, %d dropped, "
+        "%d tiles, %d duplicated for slow workers, %d requeued\n",
+        finished,
+        config.processes,
+        killed,
+        config.processes - c.alive_count,
+        c.tiles_count,
+        c.duplicated_tiles,
+        c.requeued_tiles
+    );
+    return ok;
+}
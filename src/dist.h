@@ -0,0 +1,28 @@
+#pragma once
+
+#include "render.h"
+#include "frame.h"
+#include "arena.h"
+
+// Distributed rendering: a coordinator starts `processes` copies of `rt` in
+// worker mode (its own command line plus -W), connected to each worker over
+// a Unix socket on the worker's stdin and stdout. Workers load the scene
+// once and then render tiles on request. Tiles are handed out one at a time
+// as workers become idle; the tiles of a worker that dies are put back in
+// the queue, and once the queue is empty, idle workers also take over tiles
+// that run much longer than the average.
+struct DistConfig {
+    int processes;
+    char** worker_argv;  // NULL terminated
+};
+
+bool render_distributed(
+    const DistConfig& config,
+    const Camera& camera,
+    Counter* counter,
+    FrameBuffer& frame_buffer,
+    Arena& arena
+);
+
+// Serves tile requests on stdin/stdout until the coordinator hangs up.
+int run_worker(const Camera& camera, const Scene& scene, Arena& arena);
@@ -0,0 +1,214 @@
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include "encode.h"
+#include "deflate.h"
+#include "png.h"
+#include "qoi.h"
+#include "trace.h"
+
+static const int ENCODE_BAND_HEIGHT = 64;
+
+ImageFormat image_format_from_file_name(const char* file_name) {
+    const char* ext = strrchr(file_name, '.');
+    if (ext != NULL && strcasecmp(ext, ".png") == 0) return ImageFormat_PNG;
+    if (ext != NULL && strcasecmp(ext, ".qoi") == 0) return ImageFormat_QOI;
+    return ImageFormat_PPM;
+}
+
+const char* image_format_name(ImageFormat format) {
+    switch (format) {
+    case ImageFormat_PPM: return "PPM";
+    case ImageFormat_PNG: return "PNG";
+    case ImageFormat_QOI: return "QOI";
+    }
+    return "?";
+}
+
+static void ppm_band(ByteBuffer& out, FrameBuffer& rows) {
+    out.reserve(out.size + 3 * (size_t) rows.width * rows.height);
+    for (int row = 0; row < rows.height; row++) {
+        for (int col = 0; col < rows.width; col++) {
+            RGB color = rows.get(row, col);
+            out.push(color.get_red());
+            out.push(color.get_green());
+            out.push(color.get_blue());
+        }
+    }
+}
+
+BandEncoder band_encoder(ImageFormat format, int width, int band_height, Arena& arena) {
+    BandEncoder encoder = { .format = format, .png = {} };
+    if (format == ImageFormat_PNG) encoder.png = png_encoder(width, band_height, arena);
+    return encoder;
+}
+
+void encode_band(BandEncoder& encoder, FrameBuffer& rows, EncodedBand& band) {
+    TRACE_SCOPE("encode");
+    f64 start = now_seconds();
+    band.bytes.clear();
+    band.adler = 1;
+    band.raw_size = 0;
+    switch (encoder.format) {
+    case ImageFormat_PPM:
+        ppm_band(band.bytes, rows);
+        break;
+    case ImageFormat_PNG:
+        png_band(encoder.png, band.bytes, rows, band.adler, band.raw_size);
+        break;
+    case ImageFormat_QOI:
+        qoi_band(band.bytes, rows);
+        break;
+    }
+    band.seconds = now_seconds() - start;
+}
+
+ImageWriter image_writer(ImageFormat format, FILE* file, int width, int height) {
+    return ImageWriter {
+        .format = format,
+        .file = file,
+        .width = width,
+        .height = height,
+        .ok = true,
+        .adler = 1,
+        .bytes_written = 0,
+        .encode_seconds = 0
+    };
+}
+
+static void writer_put(ImageWriter& writer, ByteBuffer& bytes) {
+    // Empty buffers (e.g. the PPM trailer) may have no data at all.
+    if (bytes.size == 0) return;
+    if (writer.ok) {
+        writer.ok = fwrite(bytes.data, 1, bytes.size, writer.file) == bytes.size;
+    }
+    writer.bytes_written += bytes.size;
+}
+
+void ImageWriter::begin() {
+    ByteBuffer header = {};
+    switch (format) {
+    case ImageFormat_PPM: {
+        char text[64];
+        int len = snprintf(text, sizeof(text), "P6\n%d\n%d\n255\n", width, height);
+        header.append((const u8*) text, len);
+        break;
+    }
+    case ImageFormat_PNG:
+        png_header(header, width, height);
+        break;
+    case ImageFormat_QOI:
+        qoi_header(header, width, height);
+        break;
+    }
+    writer_put(*this, header);
+    header.release();
+}
+
+void ImageWriter::write_band(EncodedBand& band) {
+    if (format == ImageFormat_PNG) {
+        adler = adler32_combine(adler, band.adler, band.raw_size);
+    }
+    encode_seconds += band.seconds;
+    writer_put(*this, band.bytes);
+}
+
+void ImageWriter::end() {
+    ByteBuffer trailer = {};
+    switch (format) {
+    case ImageFormat_PPM:
+        break;
+    case ImageFormat_PNG:
+        png_trailer(trailer, adler);
+        break;
+    case ImageFormat_QOI:
+        qoi_trailer(trailer);
+        break;
+    }
+    writer_put(*this, trailer);
+    trailer.release();
+    if (ok) ok = fflush(file) == 0;
+}
+
+void ImageWriter::print_stats(FILE* f) {
+    f64 raw = 3.0 * width * height;
+    fprintf(
+        f,
+        "Encoded %s: %.1f kB -> %.1f kB (%.2fx) in %.3fs of thread time\n",
+        image_format_name(format),
+        raw / 1000,
+        bytes_written / 1000.0,
+        bytes_written > 0 ? raw / bytes_written : 0,
+        encode_seconds
+    );
+}
+
+struct EncodeQueue {
+    FrameBuffer* frame_buffer;
+    EncodedBand* bands;
+    int bands_count;
+
+    pthread_mutex_t mutex;
+    int next_band;
+};
+
+struct EncodeWorker {
+    EncodeQueue* queue;
+    BandEncoder encoder;
+};
+
+static void* encode_worker(void* arg) {
+    EncodeWorker& worker = *(EncodeWorker*) arg;
+    EncodeQueue& queue = *worker.queue;
+    trace_thread_name("encode");
+    while (true) {
+        pthread_mutex_lock(&queue.mutex);
+        int band = queue.next_band++;
+        pthread_mutex_unlock(&queue.mutex);
+        if (band >= queue.bands_count) break;
+
+        int first_row = band * ENCODE_BAND_HEIGHT;
+        FrameBuffer rows = {
+            .buffer = queue.frame_buffer->buffer + (size_t) first_row * queue.frame_buffer->width,
+            .width = queue.frame_buffer->width,
+            .height = ENCODE_BAND_HEIGHT
+        };
+        if (first_row + rows.height > queue.frame_buffer->height) {
+            rows.height = queue.frame_buffer->height - first_row;
+        }
+        encode_band(worker.encoder, rows, queue.bands[band]);
+    }
+    return NULL;
+}
+
+bool encode_frame_buffer(ImageWriter& writer, FrameBuffer& frame_buffer, int threads, Arena& arena) {
+    EncodeQueue queue = {
+        .frame_buffer = &frame_buffer,
+        .bands = NULL,
+        .bands_count = (frame_buffer.height + ENCODE_BAND_HEIGHT - 1) / ENCODE_BAND_HEIGHT,
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .next_band = 0
+    };
+    queue.bands = arena.push_array_zero<EncodedBand>(queue.bands_count);
+
+    pthread_t* thread_ids = arena.push_array<pthread_t>(threads);
+    EncodeWorker* workers = arena.push_array<EncodeWorker>(threads);
+    for (int i = 0; i < threads; i++) {
+        workers[i] = EncodeWorker {
+            .queue = &queue,
+            .encoder = band_encoder(writer.format, frame_buffer.width, ENCODE_BAND_HEIGHT, arena)
+        };
+        pthread_create(&thread_ids[i], NULL, encode_worker, (void*)(&workers[i]));
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(thread_ids[i], NULL);
+    }
+
+    writer.begin();
+    for (int i = 0; i < queue.bands_count; i++) {
+        writer.write_band(queue.bands[i]);
+        queue.bands[i].bytes.release();
+    }
+    writer.end();
+    return writer.ok;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdio.h>
+#include "common.h"
+#include "byte_buffer.h"
+#include "frame.h"
+#include "arena.h"
+#include "png.h"
+
+enum ImageFormat {
+    ImageFormat_PPM,  // binary P6, the full frame path keeps writing P3
+    ImageFormat_PNG,
+    ImageFormat_QOI,
+};
+
+// Picked by the extension of the output file, PPM when not recognized.
+ImageFormat image_format_from_file_name(const char* file_name);
+const char* image_format_name(ImageFormat format);
+
+// A band of rows encoded on a worker thread, ready to be written out.
+struct EncodedBand {
+    ByteBuffer bytes;
+    u32 adler;        // PNG: checksum of the uncompressed scanlines
+    size_t raw_size;  // PNG: size of the uncompressed scanlines
+    f64 seconds;
+};
+
+// Working memory of `encode_band` for bands of up to `band_height` rows,
+// one per thread. Only PNG needs any.
+struct BandEncoder {
+    ImageFormat format;
+    PngEncoder png;
+};
+
+BandEncoder band_encoder(ImageFormat format, int width, int band_height, Arena& arena);
+
+void encode_band(BandEncoder& encoder, FrameBuffer& rows, EncodedBand& band);
+
+// Writes the header, the encoded bands in image order and the trailer, and
+// keeps the numbers reported by `print_stats`.
+struct ImageWriter {
+    ImageFormat format;
+    FILE* file;
+    int width;
+    int height;
+    bool ok;
+
+    u32 adler;
+    size_t bytes_written;
+    f64 encode_seconds;
+
+    void begin();
+    void write_band(EncodedBand& band);
+    void end();
+    void print_stats(FILE* f);
+};
+
+ImageWriter image_writer(ImageFormat format, FILE* file, int width, int height);
+
+// Encodes a whole frame in bands on `threads` threads and writes it.
+bool encode_frame_buffer(ImageWriter& writer, FrameBuffer& frame_buffer, int threads, Arena& arena);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdio.h>
+#include "common.h"
+
+struct RGB {
+    i32 mem;
+
+    RGB() : mem(0) {}
+
+    RGB(u8 red, u8 green, u8 blue) {
+        mem = red * (1 << 16) + green * (1 << 8) + blue;
+    }
+
+    inline u8 get_red() { return (u8) (mem / (1 << 16)); }
+    inline u8 get_green() { return (u8) (mem / (1 << 8)) ; }
+    inline u8 get_blue() { return (u8) mem; }
+
+    void print() {
+        fprint(stdout);
+    }
+
+    void fprint(FILE* f) {
+        fprintf(f, "RGB(%hhu, %hhu, %hhu)", get_red(), get_green(), get_blue());
+    }
+};
+
+struct FrameBuffer {
+    RGB* buffer;
+    int width;
+    int height;
+
+    void set(int row, int col, RGB color) {
+        buffer[(i64) row * width + col] = color;
+    }
+
+    RGB get(int row, int col) {
+        return buffer[(i64) row * width + col];
+    }
+
+    void to_ppm(FILE* f) {
+        fprintf(f, "P3\n%d\n%d\n255\n", width, height);
+        for (int row = 0; row < height; row++) {
+            for (int col = 0; col < width; col++) {
+                RGB color = get(row, col);
+                fprintf(f, "%hhu %hhu %hhu\n", color.get_red(), color.get_green(), color.get_blue());
+            }
+        }
+    }
+};
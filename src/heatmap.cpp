@@ -0,0 +1,101 @@
+#include <math.h>
+#include "heatmap.h"
+#include "frame.h"
+#include "encode.h"
+
+Heatmap heatmap_create(int width, int height, Arena& arena) {
+    return Heatmap {
+        .width = width,
+        .height = height,
+        .ns = arena.push_array_zero<f32>((size_t) width * height)
+    };
+}
+
+void Heatmap::add_tile(int row0, int row1, int col0, int col1, f64 ns_spent) {
+    f64 share = ns_spent / ((f64) (row1 - row0) * (col1 - col0));
+    for (int row = row0; row < row1; row++) {
+        for (int col = col0; col < col1; col++) {
+            add(row, col, share);
+        }
+    }
+}
+
+static RGB heat_color(f64 v) {
+    static const f64 ramp[][3] = {
+        {0, 0, 0},
+        {0, 0, 255},
+        {255, 0, 0},
+        {255, 255, 0},
+        {255, 255, 255}
+    };
+    const int last = sizeof(ramp) / sizeof(ramp[0]) - 1;
+    f64 x = fmin(fmax(v, 0), 1) * last;
+    int i = x >= last ? last - 1 : (int) x;
+    f64 w = x - i;
+    return RGB(
+        (int) (ramp[i][0] + w * (ramp[i + 1][0] - ramp[i][0])),
+        (int) (ramp[i][1] + w * (ramp[i + 1][1] - ramp[i][1])),
+        (int) (ramp[i][2] + w * (ramp[i + 1][2] - ramp[i][2]))
+    );
+}
+
+// Cost at the given fraction of the pixels, from a histogram of the range.
+static f64 percentile(const f32* ns, i64 pixels, f64 lo, f64 hi, f64 fraction) {
+    const int BUCKETS = 1024;
+    i64 counts[BUCKETS] = {};
+    f64 bucket_size = (hi - lo) / BUCKETS;
+    if (bucket_size <= 0) return hi;
+    for (i64 i = 0; i < pixels; i++) {
+        int b = (int) ((ns[i] - lo) / bucket_size);
+        counts[b < BUCKETS ? b : BUCKETS - 1]++;
+    }
+    i64 seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= fraction * pixels) return lo + (b + 1) * bucket_size;
+    }
+    return hi;
+}
+
+bool Heatmap::write(const char* file_name, int threads, Arena& arena) const {
+    i64 pixels = (i64) width * height;
+    f64 lo = F64_INF;
+    f64 hi = 0;
+    for (i64 i = 0; i < pixels; i++) {
+        lo = fmin(lo, ns[i]);
+        hi = fmax(hi, ns[i]);
+    }
+    hi = percentile(ns, pixels, lo, hi, 0.99);
+    f64 range = hi - lo;
+
+    FrameBuffer image = {
+        .buffer = arena.push_array<RGB>(pixels),
+        .width = width,
+        .height = height
+    };
+    for (i64 i = 0; i < pixels; i++) {
+        image.buffer[i] = heat_color(range > 0 ? (ns[i] - lo) / range : 0);
+    }
+
+    FILE* f = fopen(file_name, "w");
+    if (f == NULL) return false;
+    ImageWriter writer = image_writer(image_format_from_file_name(file_name), f, width, height);
+    bool ok = encode_frame_buffer(writer, image, threads, arena);
+    return fclose(f) == 0 && ok;
+}
+
+void Heatmap::fprint_stats(FILE* f) const {
+    i64 pixels = (i64) width * height;
+    f64 total = 0;
+    f64 hi = 0;
+    for (i64 i = 0; i < pixels; i++) {
+        total += ns[i];
+        hi = fmax(hi, ns[i]);
+    }
+    fprintf(
+        f,
+        "Heatmap: %.2f us per pixel on average, %.2f us at most\n",
+        pixels > 0 ? total / pixels / 1e3 : 0.0,
+        hi / 1e3
+    );
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+#include "common.h"
+#include "arena.h"
+
+// CPU time spent on each pixel, written out as a false color image: black
+// for the cheapest pixels through blue, red and yellow to white for the most
+// expensive ones. The scale ends at the 99th percentile so that a few
+// outliers don't wash out the rest of the image. Ray cast pixels are timed
+// one by one; rasterized pixels get an even share of their bin's time.
+// Thread CPU time is used so that threads waiting for a core don't show up
+// as hot spots.
+struct Heatmap {
+    int width;
+    int height;
+    f32* ns;
+
+    inline void add(int row, int col, f64 ns_spent) {
+        ns[(i64) row * width + col] += (f32) ns_spent;
+    }
+
+    // Spreads `ns_spent` evenly over the pixels in [row0, row1) x [col0, col1).
+    void add_tile(int row0, int row1, int col0, int col1, f64 ns_spent);
+
+    bool write(const char* file_name, int threads, Arena& arena) const;
+    void fprint_stats(FILE* f) const;
+};
+
+Heatmap heatmap_create(int width, int height, Arena& arena);
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include "hit_cache.h"
+
+struct Edge {
+    int a, b;  // vertex indices, a < b
+    int slot;  // triangle * HIT_CACHE_NEIGHBOURS + edge
+};
+
+static int compare_edges(const void* x, const void* y) {
+    const Edge* e = (const Edge*) x;
+    const Edge* f = (const Edge*) y;
+    if (e->a != f->a) return e->a < f->a ? -1 : 1;
+    if (e->b != f->b) return e->b < f->b ? -1 : 1;
+    return e->slot - f->slot;
+}
+
+// Triangles sharing an edge are found by sorting all edges by their vertex
+// indices. An edge shared by more than two triangles links them in a ring.
+static void find_neighbours(const Obj::Mesh& mesh, int triangles_count, int* neighbours, Arena& arena) {
+    int edges_count = triangles_count * HIT_CACHE_NEIGHBOURS;
+    Edge* edges = arena.push_array<Edge>(edges_count);
+    for (int i = 0; i < triangles_count; i++) {
+        for (int k = 0; k < HIT_CACHE_NEIGHBOURS; k++) {
+            int a = (int) (mesh.faces[i].gv[k] - mesh.vertices);
+            int b = (int) (mesh.faces[i].gv[(k + 1) % 3] - mesh.vertices);
+            int slot = i * HIT_CACHE_NEIGHBOURS + k;
+            edges[slot] = Edge { .a = a < b ? a : b, .b = a < b ? b : a, .slot = slot };
+            neighbours[slot] = -1;
+        }
+    }
+    qsort(edges, edges_count, sizeof(Edge), compare_edges);
+
+    for (int start = 0; start < edges_count;) {
+        int end = start + 1;
+        while (end < edges_count && edges[end].a == edges[start].a && edges[end].b == edges[start].b) {
+            end++;
+        }
+        if (end - start > 1) {
+            for (int i = start; i < end; i++) {
+                int next = i + 1 < end ? i + 1 : start;
+                neighbours[edges[i].slot] = edges[next].slot / HIT_CACHE_NEIGHBOURS;
+            }
+        }
+        start = end;
+    }
+}
+
+HitCache hit_cache_create(const Obj::Mesh& mesh, int width, int height, Arena& arena) {
+    HitCache cache = {
+        .width = width,
+        .height = height,
+        .pixels = arena.push_array<int>((size_t) width * height),
+        .neighbours = arena.push_array<int>((size_t) mesh.faces_count * HIT_CACHE_NEIGHBOURS)
+    };
+    for (i64 i = 0; i < (i64) width * height; i++) cache.pixels[i] = -1;
+    find_neighbours(mesh, mesh.faces_count, cache.neighbours, arena);
+    return cache;
+}
+
+int hit_cache_trace(
+    HitCache& cache,
+    const Scene& scene,
+    const Ray& ray,
+    int row,
+    int col,
+    HitCacheStats& stats
+) {
+    i64 pixel = (i64) row * cache.width + col;
+    int& cached = cache.pixels[pixel];
+    bool sampled = pixel % HIT_CACHE_SAMPLE_STRIDE == 0;
+    i64 start_ns = sampled ? thread_now_ns() : 0;
+
+    f64 best_t = F64_INF;
+    int best_i = -1;
+    int candidates[1 + HIT_CACHE_NEIGHBOURS];
+    if (cached >= 0) {
+        candidates[0] = cached;
+        for (int k = 0; k < HIT_CACHE_NEIGHBOURS; k++) {
+            candidates[1 + k] = cache.neighbours[cached * HIT_CACHE_NEIGHBOURS + k];
+        }
+        best_i = trace_ray_candidates(scene, ray, candidates, 1 + HIT_CACHE_NEIGHBOURS, best_t);
+    }
+    int min_i = trace_ray_bounded(scene, ray, best_t, best_i, &stats.trace);
+
+    if (sampled) {
+        i64 cached_end_ns = thread_now_ns();
+        trace_ray(scene, ray);
+        stats.sampled++;
+        stats.cached_ns += cached_end_ns - start_ns;
+        stats.plain_ns += thread_now_ns() - cached_end_ns;
+    }
+    if (cached >= 0) {
+        stats.lookups++;
+        if (min_i >= 0 && min_i == best_i) stats.hits++;
+    }
+    cached = min_i;
+    return min_i;
+}
+
+void HitCacheStats::fprint(FILE* f) const {
+    fprintf(
+        f,
+        "hit cache %.1f%% hits (%lld of %lld pixels), ~%.3fs saved (%lld rays timed both ways); "
+        "%.1f triangles tested per ray, %.1f%% of them culled before the edge tests",
+        lookups > 0 ? 100.0 * hits / lookups : 0.0,
+        (long long) hits,
+        (long long) lookups,
+        saved_seconds(),
+        (long long) sampled,
+        trace.rays > 0 ? (f64) trace.triangles / trace.rays : 0.0,
+        trace.triangles > 0 ? 100.0 * trace.culled / trace.triangles : 0.0
+    );
+}
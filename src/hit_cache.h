@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdio.h>
+#include "render.h"
+#include "arena.h"
+
+const int HIT_CACHE_NEIGHBOURS = 3;
+// Every this many pixels one is also traced without the cache, to time
+// both. Prime, so the samples don't line up in columns.
+const int HIT_CACHE_SAMPLE_STRIDE = 61;
+
+// Per pixel cache of the triangle hit in the previous frame. When the mesh
+// or the camera move only a little between frames, most pixels see the same
+// triangle again, or one sharing an edge with it. Testing those first gives
+// a close hit distance, which the full query (scan or hierarchy) then uses
+// to skip what lies behind it. The image is the same as without the cache.
+struct HitCache {
+    int width;
+    int height;
+    int* pixels;      // previous frame's triangle per pixel, -1 for a miss
+    int* neighbours;  // HIT_CACHE_NEIGHBOURS per triangle, -1 for an open edge
+};
+
+struct HitCacheStats {
+    i64 lookups;    // rays whose pixel hit a triangle in the previous frame
+    i64 hits;       // of those, rays whose closest hit was among the candidates
+    i64 sampled;    // rays also traced without the cache
+    i64 cached_ns;  // time the sampled rays took with the cache
+    i64 plain_ns;   // and without it
+    TraceStats trace;
+
+    void add(const HitCacheStats& other) {
+        lookups += other.lookups;
+        hits += other.hits;
+        sampled += other.sampled;
+        cached_ns += other.cached_ns;
+        plain_ns += other.plain_ns;
+        trace.rays += other.trace.rays;
+        trace.triangles += other.trace.triangles;
+        trace.culled += other.trace.culled;
+    }
+
+    // Tracing time saved over all rays, estimated from the sampled ones.
+    // Thread CPU time summed over the threads, not wall time.
+    f64 saved_seconds() const {
+        return sampled > 0 ? (plain_ns - cached_ns) / 1e9 * trace.rays / sampled : 0;
+    }
+
+    void fprint(FILE* f) const;
+};
+
+// The cache starts empty; it has to live as long as the scene. Triangles
+// are numbered like the faces of `mesh`, which is the scene's mesh or the
+// one its hierarchy was built from, and is only read here.
+HitCache hit_cache_create(const Obj::Mesh& mesh, int width, int height, Arena& arena);
+
+// Closest triangle hit by the pixel's ray, same as `trace_ray`. Each pixel
+// must be traced by one thread at a time.
+int hit_cache_trace(
+    HitCache& cache,
+    const Scene& scene,
+    const Ray& ray,
+    int row,
+    int col,
+    HitCacheStats& stats
+);
@@ -0,0 +1,140 @@
+#include <math.h>
+#include <stdlib.h>
+#include "layout.h"
+#include "vec3.h"
+
+// Vertices closer than this fraction of the bounding box diagonal are
+// merged. Far below anything visible, but enough to catch positions that
+// were written out twice with rounding.
+const f64 WELD_TOLERANCE = 1e-9;
+
+static void mesh_bounds(const Vec3* points, int count, Vec3& lo, Vec3& hi) {
+    lo = Vec3 { .x = F64_INF, .y = F64_INF, .z = F64_INF };
+    hi = -lo;
+    for (int i = 0; i < count; i++) {
+        Vec3 p = points[i];
+        lo = Vec3 { .x = fmin(lo.x, p.x), .y = fmin(lo.y, p.y), .z = fmin(lo.z, p.z) };
+        hi = Vec3 { .x = fmax(hi.x, p.x), .y = fmax(hi.y, p.y), .z = fmax(hi.z, p.z) };
+    }
+}
+
+struct WeldCell {
+    i64 x, y, z;
+    int head;  // first vertex in the cell, -1 for an empty slot
+};
+
+struct WeldGrid {
+    WeldCell* cells;
+    u64 mask;
+};
+
+static WeldCell& weld_cell(WeldGrid& grid, i64 x, i64 y, i64 z) {
+    u64 h = (u64) x * 73856093 ^ (u64) y * 19349663 ^ (u64) z * 83492791;
+    h *= 0x9E3779B97F4A7C15ull;
+    for (u64 i = h >> 20;; i++) {
+        WeldCell& cell = grid.cells[i & grid.mask];
+        if (cell.head == -1 || (cell.x == x && cell.y == y && cell.z == z)) return cell;
+    }
+}
+
+Obj::Mesh* weld_vertices(const Obj::Mesh& mesh, Arena& arena, Arena& scratch, int& welded) {
+    int n = mesh.vertices_count;
+    Vec3 lo, hi;
+    mesh_bounds(mesh.vertices, n, lo, hi);
+    f64 tolerance = WELD_TOLERANCE * vec3_length(hi - lo);
+    // Cells at least as large as the tolerance, so that matches are always
+    // in the same or a neighbouring cell.
+    f64 cell_size = tolerance > 0 ? tolerance : 1;
+
+    u64 slots = 16;
+    while (slots < 2 * (u64) n) slots *= 2;
+    WeldGrid grid = { .cells = scratch.push_array<WeldCell>(slots), .mask = slots - 1 };
+    for (u64 i = 0; i < slots; i++) grid.cells[i].head = -1;
+
+    Vec3* vertices = scratch.push_array<Vec3>(n);
+    int* next_in_cell = scratch.push_array<int>(n);
+    int* remap = scratch.push_array<int>(n);
+    int count = 0;
+
+    for (int i = 0; i < n; i++) {
+        Vec3 p = mesh.vertices[i];
+        i64 cx = (i64) floor((p.x - lo.x) / cell_size);
+        i64 cy = (i64) floor((p.y - lo.y) / cell_size);
+        i64 cz = (i64) floor((p.z - lo.z) / cell_size);
+
+        int match = -1;
+        for (int d = 0; d < 27 && match == -1; d++) {
+            WeldCell& cell = weld_cell(grid, cx + d % 3 - 1, cy + d / 3 % 3 - 1, cz + d / 9 - 1);
+            for (int j = cell.head; j != -1; j = next_in_cell[j]) {
+                Vec3 q = vertices[j];
+                if (fabs(p.x - q.x) <= tolerance && fabs(p.y - q.y) <= tolerance && fabs(p.z - q.z) <= tolerance) {
+                    match = j;
+                    break;
+                }
+            }
+        }
+
+        if (match == -1) {
+            match = count++;
+            vertices[match] = p;
+            WeldCell& cell = weld_cell(grid, cx, cy, cz);
+            if (cell.head == -1) {
+                cell.x = cx;
+                cell.y = cy;
+                cell.z = cz;
+            }
+            next_in_cell[match] = cell.head;
+            cell.head = match;
+        }
+        remap[i] = match;
+    }
+
+    int* corners = scratch.push_array<int>(3 * (size_t) mesh.faces_count);
+    for (int f = 0; f < mesh.faces_count; f++) {
+        for (int k = 0; k < 3; k++) {
+            corners[3 * f + k] = remap[mesh.faces[f].gv[k] - mesh.vertices];
+        }
+    }
+    welded = n - count;
+    return Obj::build(count, vertices, mesh.faces_count, corners, arena);
+}
+
+// Spreads the low 21 bits of v out to every third bit.
+static u64 spread_bits(u64 v) {
+    v &= 0x1FFFFF;
+    v = (v | v << 32) & 0x1F00000000FFFFull;
+    v = (v | v << 16) & 0x1F0000FF0000FFull;
+    v = (v | v << 8) & 0x100F00F00F00F00Full;
+    v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+static int compare_morton_keys(const void* x, const void* y) {
+    const MortonKey* a = (const MortonKey*) x;
+    const MortonKey* b = (const MortonKey*) y;
+    if (a->code != b->code) return a->code < b->code ? -1 : 1;
+    return a->index - b->index;
+}
+
+MortonKey* sort_morton(const Vec3* points, int count, Arena& arena) {
+    Vec3 lo, hi;
+    mesh_bounds(points, count, lo, hi);
+    Vec3 extent = hi - lo;
+    f64 scale = (f64) 0x1FFFFF / fmax(fmax(extent.x, extent.y), fmax(extent.z, 1e-300));
+
+    MortonKey* keys = arena.push_array<MortonKey>(count);
+    for (int i = 0; i < count; i++) {
+        Vec3 c = points[i] - lo;
+        keys[i] = MortonKey {
+            .code = (
+                spread_bits((u64) (c.x * scale)) |
+                spread_bits((u64) (c.y * scale)) << 1 |
+                spread_bits((u64) (c.z * scale)) << 2
+            ),
+            .index = i
+        };
+    }
+    qsort(keys, count, sizeof(MortonKey), compare_morton_keys);
+    return keys;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "obj.h"
+#include "arena.h"
+
+// Memory layout passes used to build the hierarchy.
+
+// Merges vertices closer than a tiny fraction of the mesh's size, found
+// through a spatial hash, so faces that share a corner also share the
+// vertex. The new mesh goes to `arena` and `scratch` holds working state;
+// `welded` receives the number of vertices merged away.
+Obj::Mesh* weld_vertices(const Obj::Mesh& mesh, Arena& arena, Arena& scratch, int& welded);
+
+struct MortonKey {
+    u64 code;
+    int index;
+};
+
+// Keys of the points along a Morton curve through their bounding box, in
+// curve order (points with the same code by index).
+MortonKey* sort_morton(const Vec3* points, int count, Arena& arena);
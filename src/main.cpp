@@ -1,4 +1,6 @@
 #include <cstdlib>
+#include <math.h>
+#include <string.h>
 #include <stdio.h>
 #include <sys/time.h>
 #include <pthread.h>
@@ -7,133 +9,42 @@
 #include "common.h"
 #include "obj.h"
 #include "cmd.h"
-
-struct RGB {
-    i32 mem;
-
-    RGB(u8 red, u8 green, u8 blue) {
-        mem = red * (1 << 16) + green * (1 << 8) + blue;
-    }
-
-    inline u8 get_red() { return (u8) (mem / (1 << 16)); }
-    inline u8 get_green() { return (u8) (mem / (1 << 8)) ; }
-    inline u8 get_blue() { return (u8) mem; }
-
-    void print() {
-        fprint(stdout);
-    }
-
-    void fprint(FILE* f) {
-        fprintf(f, "RGB(%hhu, %hhu, %hhu)", get_red(), get_green(), get_blue());
-    }
-};
-
-struct FrameBuffer {
-    RGB* buffer;
-    int width;
-    int height;
-
-    void set(int row, int col, RGB color) {
-        buffer[(row * width) + col] = color;
-    }
-
-    RGB get(int row, int col) {
-        return buffer[(row * width) + col];
-    }
-
-    void to_ppm(FILE* f) {
-        fprintf(f, "P3\n%d\n%d\n255\n", width, height);
-        for (int row = 0; row < height; row++) {
-            for (int col = 0; col < width; col++) {
-                RGB color = get(row, col);
-                fprintf(f, "%hhu %hhu %hhu\n", color.get_red(), color.get_green(), color.get_blue());
-            }
-        }
-    }
-};
-
-using Point3 = Vec3;
-
-struct Triangle {
-    Point3 a, b, c;
-};
-
-Vec3 triangle_normal(Triangle triangle) {
-    Vec3 A = triangle.b - triangle.a;
-    Vec3 B = triangle.c - triangle.a;
-    return vec3_cross(A, B);
-}
-
-struct Ray {
-    Point3 origin;
-    Vec3 direction;
-
-    void print() {
-        fprint(stdout);
-    }
-
-    void fprint(FILE *f) {
-        fprintf(f, "Ray<origin: ");
-        origin.fprint(f);
-        fprintf(f, ", direction: ");
-        direction.fprint(f);
-        fprintf(f, ">");
-    }
-};
-
-f64 hit_triangle(const Triangle& triangle, const Vec3& n, const Ray& ray) {
-    f64 n_dot_d = vec3_dot(ray.direction, n);
-    if (n_dot_d == 0) return -1;
-
-    f64 d = -vec3_dot(n, triangle.a);
-    f64 t = -(vec3_dot(n, ray.origin) + d) / n_dot_d;
-    if (t < 0) return -1;
-
-    Point3 p = ray.origin + t * ray.direction;
-
-    Vec3 e0 = triangle.b - triangle.a;
-    Vec3 e1 = triangle.c - triangle.b;
-    Vec3 e2 = triangle.a - triangle.c;
-    if (
-        vec3_dot(n, vec3_cross(e0, p - triangle.a)) > 0 &&
-        vec3_dot(n, vec3_cross(e1, p - triangle.b)) > 0 &&
-        vec3_dot(n, vec3_cross(e2, p - triangle.c)) > 0
-    ) {
-        return t;
-    } else {
-        return -1;
-    }
-}
-
-Obj::Mesh* parse_obj(const char* file_name) {
+#include "frame.h"
+#include "render.h"
+#include "stream.h"
+#include "encode.h"
+#include "dist.h"
+#include "arena.h"
+#include "hit_cache.h"
+#include "raster.h"
+#include "trace.h"
+#include "heatmap.h"
+#include "simplify.h"
+#include "layout.h"
+#include "perf.h"
+#include "bvh.h"
+
+const size_t SCENE_ARENA_BLOCK_SIZE = 4 << 20;
+const size_t FRAME_ARENA_BLOCK_SIZE = 4 << 20;
+const size_t LOAD_ARENA_BLOCK_SIZE = 4 << 20;
+
+// Pixels traced between progress updates.
+const int PIXELS_PER_UPDATE = 1000;
+// When tracing, pixels are handed out in square tiles of this size (the
+// tiles in random order) and each tile is one span in the trace.
+const int TRACE_TILE_SIZE = 32;
+
+Obj::Mesh* parse_obj(const char* file_name, Arena& arena) {
     Obj::MeshInfo info;
     bool ok = Obj::calc_memory(file_name, info);
     if (!ok) {
         printf("Failed to open file: \"%s\"\n", file_name);
         exit(1);
     }
-    size_t mem = sizeof(Obj::Mesh) + info.vertices_mem + info.normals_mem + info.faces_mem;
-    void* buffer = malloc(mem);
-    Obj::Mesh* mesh = Obj::parse(file_name, buffer, info);
+    Obj::Mesh* mesh = Obj::parse(file_name, arena, info);
     return mesh;
 }
 
-RGB get_rand_color(int i) {
-    static RGB colors[] = {
-        RGB(125, 125, 125),
-        RGB(185, 185, 185),
-        // RGB(255, 0, 0),
-        // RGB(0, 255, 0),
-        // RGB(0, 0, 255),
-        // RGB(255, 255, 0),
-        // RGB(0, 255, 255),
-        // RGB(255, 0, 255),
-        // RGB(60, 60, 60),
-        // RGB(255, 255, 255)
-    };
-    return colors[i%2];
-}
-
 struct Pixel {
     int row;
     int col;
@@ -148,7 +59,7 @@ void shuffle_pixels(Pixel* array, size_t n) {
     if (n > 1) {
         size_t i;
         for (i = n - 1; i > 0; i--) {
-            size_t j = (unsigned int) (drand48()*(i+1));
+            size_t j = (size_t) (drand48()*(i+1));
             Pixel t = array[j];
             array[j] = array[i];
             array[i] = t;
@@ -156,126 +67,91 @@ void shuffle_pixels(Pixel* array, size_t n) {
     }
 }
 
-struct Counter {
-    int val;
-    pthread_mutex_t mutex;
-
-    Counter(int val = 0) : val(val) {
-        mutex = PTHREAD_MUTEX_INITIALIZER;
-    }
-
-    void inc(int v) {
-        pthread_mutex_lock(&mutex);
-        val += v;
-        pthread_mutex_unlock(&mutex);
-    }
-};
-
-struct Camera {
-    int height;
-    int width;
-    Point3 top_left_pixel;
-    Point3 origin;
-    Vec3 viewport_width_d;
-    Vec3 viewport_height_d;
-
-    Camera(
-        int height,
-        int width,
-        const Vec3& origin,
-        const Vec3& focal_offset
-    ) : width(width), height(height), origin(origin) {
-        f64 aspect_ratio = ((f64)width) / height;
-
-        f64 viewport_width = 2.0;
-        Vec3 viewport_width_v = Vec3 { .x = viewport_width };
-        f64 viewport_height = viewport_width / aspect_ratio;
-        Vec3 viewport_height_v = Vec3 { .y = viewport_height };
-
-        top_left_pixel = (
-            origin - focal_offset + viewport_width_v/2 + viewport_height_v/2
-        );
-
-        viewport_width_d = Vec3 { .x = viewport_width / width };
-        viewport_height_d = Vec3 { .y = viewport_height / height };
-    }
-
-    inline int pixels() { return height * width; }
-};
+inline i64 trace_tile(const Camera& camera, const Pixel& pixel) {
+    int tile_cols = (camera.width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+    return (i64) (pixel.row / TRACE_TILE_SIZE) * tile_cols + pixel.col / TRACE_TILE_SIZE;
+}
 
 void _process_batch(
     const Camera& camera,
-    const Triangle* triangles,
-    const Vec3* normals,
-    const Obj::Mesh& mesh,
+    const Scene& scene,
     FrameBuffer frame_buffer,
-    int tasks_count,
+    i64 tasks_count,
     Pixel* tasks,
-    Counter* counter
+    Counter* counter,
+    HitCache* cache,
+    HitCacheStats& cache_stats,
+    Heatmap* heatmap
 ){
-    for (int i = 0; i < tasks_count; i++) {
-        int row = tasks[i].row;
-        int col = tasks[i].col;
-        Point3 curr = camera.top_left_pixel - 0.5 * camera.viewport_width_d - row * camera.viewport_height_d - col * camera.viewport_width_d;
-        f64 min_t = F64_INF;
-        int min_i = -1;
-        for (int i = 0; i < mesh.faces_count; i++) {
-            Ray ray = { .origin = camera.origin, .direction = curr - camera.origin };
-            f64 new_t = hit_triangle(triangles[i], normals[i], ray);
-            if (new_t > 0 && new_t < min_t) {
-                min_t = new_t;
-                min_i = i;
-            }
-        }
-        if (min_t != F64_INF) {
-            frame_buffer.set(row, col, get_rand_color(min_i));
+    for (i64 start = 0, end; start < tasks_count; start = end) {
+        i64 tile = -1;
+        if (trace_enabled) {
+            tile = trace_tile(camera, tasks[start]);
+            end = start + 1;
+            while (end < tasks_count && trace_tile(camera, tasks[end]) == tile) end++;
+        } else {
+            end = start + PIXELS_PER_UPDATE < tasks_count ? start + PIXELS_PER_UPDATE : tasks_count;
         }
-        if (i > 0 && i % 1000 == 0) {
-            counter->inc(1000);
+        TRACE_SCOPE("tile", tile);
+        for (i64 i = start; i < end; i++) {
+            i64 pixel_start_ns = heatmap != NULL ? thread_now_ns() : 0;
+            int row = tasks[i].row;
+            int col = tasks[i].col;
+            Ray ray = camera.pixel_ray(row, col);
+            int min_i = cache != NULL
+                ? hit_cache_trace(*cache, scene, ray, row, col, cache_stats)
+                : trace_ray(scene, ray);
+            if (min_i >= 0) {
+                frame_buffer.set(row, col, get_rand_color(min_i));
+            }
+            if (heatmap != NULL) heatmap->add(row, col, thread_now_ns() - pixel_start_ns);
         }
+        counter->inc(end - start);
     }
-    counter->inc(tasks_count % 1000);
 }
 
 struct BatchArgs {
     Camera* camera;
-    Triangle* triangles;
-    Vec3* normals;
-    Obj::Mesh* mesh;
+    Scene* scene;
     FrameBuffer frame_buffer;
-    int pixels_count;
+    i64 pixels_count;
     Pixel* pixels;
     Counter* counter;
+    HitCache* cache;
+    HitCacheStats cache_stats;
+    Heatmap* heatmap;
 };
 
 void* process_batch(void* arg) {
     BatchArgs* args = (BatchArgs*) arg;
+    trace_thread_name("render");
     _process_batch(
         *args->camera,
-        args->triangles,
-        args->normals,
-        *args->mesh,
+        *args->scene,
         args->frame_buffer,
         args->pixels_count,
         args->pixels,
-        args->counter
+        args->counter,
+        args->cache,
+        args->cache_stats,
+        args->heatmap
     );
     return NULL;
 }
 
 struct StatusPrinterArgs {
     Counter* counter;
-    int pixels_count;
+    i64 pixels_count;
     bool* done;
 };
 
 void _print_status(StatusPrinterArgs* args) {
-    int val = args->counter->val;
+    i64 val = args->counter->val;
     fprintf(
         stderr,
-        "\r%dk/%dk (%d%%)                    ",
-        val/1000,
-        args->pixels_count/1000,
+        "\r%lldk/%lldk (%d%%)                    ",
+        (long long) val/1000,
+        (long long) args->pixels_count/1000,
         (int)((f64) val * 100 / args->pixels_count)
     );
 }
@@ -292,69 +168,233 @@ void* status_printer(void* args) {
 }
 
 
-int main(int argc, char** argv) {
-    CmdArgs cmd_args;
-    if (!parse_cmd_args(argc, argv, cmd_args)) {
-        return 0;
+Camera frame_camera(const CmdArgs& cmd_args, int frame) {
+    return Camera(
+        cmd_args.height,
+        cmd_args.width,
+        cmd_args.camera_origin + frame * cmd_args.camera_nudge,
+        cmd_args.focal_offset
+    );
+}
+
+// Largest simplification error allowed by the closest camera of the
+// sequence.
+f64 sequence_lod_max_error(const CmdArgs& cmd_args, const Obj::Mesh& mesh) {
+    f64 max_error = F64_INF;
+    for (int frame = 0; frame < cmd_args.frames; frame++) {
+        Camera camera = frame_camera(cmd_args, frame);
+        max_error = fmin(max_error, lod_max_error(camera, mesh, cmd_args.lod_pixels));
     }
+    return max_error;
+}
 
-    auto camera = Camera(cmd_args.height, cmd_args.width, cmd_args.camera_origin, cmd_args.focal_offset);
+// With a `load_arena` the file is parsed into it and only the final mesh
+// goes to `arena`, so memory use follows what is rendered.
+Obj::Mesh* load_mesh(const CmdArgs& cmd_args, Arena& arena, Arena* temporary, bool verbose) {
+    if (temporary == NULL) {
+        Obj::Mesh* mesh = parse_obj(cmd_args.in_file_name, arena);
+        if (verbose) fprintf(stderr, "Triangle Count: %d\n", mesh->faces_count);
+        return mesh;
+    }
 
-    RGB* buffer = (RGB*) calloc(camera.pixels(), sizeof(RGB));
-    FrameBuffer frame_buffer = { .buffer = buffer, .width = camera.width, .height = camera.height };
+    bool lod = cmd_args.lod_pixels > 0;
+    Arena& load_arena = *temporary;
+    Obj::Mesh* mesh = parse_obj(cmd_args.in_file_name, load_arena);
+    int faces_count = mesh->faces_count;
+    if (verbose) fprintf(stderr, "Triangle Count: %d\n", faces_count);
+
+    // Triangle blocks in the hierarchy share a vertex only when their faces
+    // share its index, so corners written out twice are merged first.
+    if (cmd_args.bvh) {
+        TRACE_SCOPE("weld");
+        int vertices_count = mesh->vertices_count;
+        int welded;
+        mesh = weld_vertices(*mesh, lod ? load_arena : arena, load_arena, welded);
+        if (verbose) fprintf(stderr, "Welded %d of %d vertices\n", welded, vertices_count);
+    }
 
-    fprintf(stderr, "Parsing obj file: \"%s\"\n", cmd_args.in_file_name);
-    Obj::Mesh* mesh = parse_obj(cmd_args.in_file_name);
-    fprintf(stderr, "Triangle Count: %d\n", mesh->faces_count);
+    if (lod) {
+        TRACE_SCOPE("simplify");
+        f64 max_error = sequence_lod_max_error(cmd_args, *mesh);
+        LodStats stats;
+        mesh = simplify_mesh(*mesh, max_error, arena, load_arena, stats);
+        if (verbose) {
+            fprintf(
+                stderr,
+                "Level of detail: level %d, %d of %d triangles, error %.3g (%.3g allowed)\n",
+                stats.level,
+                stats.triangles_count,
+                faces_count,
+                stats.error,
+                max_error
+            );
+        }
+    }
+    return mesh;
+}
 
-    Triangle* triangles = (Triangle*) malloc(sizeof(Triangle) * mesh->faces_count);
-    Vec3* normals = (Vec3*) malloc(sizeof(Vec3) * mesh->faces_count);
+// With a `cache` the hit cache is set up too, while the mesh is around.
+Scene load_scene(const CmdArgs& cmd_args, Arena& arena, bool verbose, HitCache* cache) {
+    TRACE_SCOPE("parse");
+    if (verbose) fprintf(stderr, "Parsing obj file: \"%s\"\n", cmd_args.in_file_name);
+    bool preprocess = cmd_args.lod_pixels > 0 || cmd_args.bvh;
+    Arena load_arena = {};
+    if (preprocess) load_arena = arena_create("load", LOAD_ARENA_BLOCK_SIZE, true);
 
-    for (int i = 0; i < mesh->faces_count; i++) {
-        Obj::Face face = mesh->faces[i];
-        triangles[i] = Triangle {
-            .a = *face.gv[0],
-            .b = *face.gv[1],
-            .c = *face.gv[2]
+    Scene scene = {};
+    Obj::Mesh* mesh;
+    if (cmd_args.bvh) {
+        // The hierarchy holds its own copy of the triangles, the mesh is
+        // only needed while building it.
+        mesh = load_mesh(cmd_args, load_arena, &load_arena, verbose);
+        TRACE_SCOPE("hierarchy");
+        bool posable = cmd_args.frames > 1 && cmd_args.turntable != 0;
+        scene.triangles_count = mesh->faces_count;
+        scene.bvh = bvh_create(*mesh, posable, arena, load_arena);
+        if (verbose) scene.bvh->fprint_stats(stderr);
+    } else {
+        mesh = load_mesh(cmd_args, arena, preprocess ? &load_arena : NULL, verbose);
+        scene = Scene {
+            .triangles_count = mesh->faces_count,
+            .triangles = arena.push_array<Triangle>(mesh->faces_count),
+            .normals = arena.push_array<Vec3>(mesh->faces_count),
+            .mesh = mesh,
+            .bvh = NULL
         };
-        // TODO: use precalculated normals when available
-        normals[i] = triangle_normal(triangles[i]);
+        pose_scene(scene, 0);
     }
 
-    Pixel* pixels = (Pixel*) malloc(sizeof(Pixel) * camera.pixels());
-    int i = 0;
-    for (int row = 0; row < camera.height; row++) {
-        for (int col = 0; col < camera.width; col++) {
-            pixels[i++] = Pixel { .row = row, .col = col };
-        }
+    if (cache != NULL) {
+        TRACE_SCOPE("hit cache setup");
+        if (scene.bvh != NULL) bvh_index(*scene.bvh, arena);
+        *cache = hit_cache_create(*mesh, cmd_args.width, cmd_args.height, arena);
     }
-    shuffle_pixels(pixels, camera.pixels());
 
-    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * cmd_args.threads);
-    BatchArgs* args = (BatchArgs*) malloc(sizeof(BatchArgs) * cmd_args.threads);
+    if (preprocess) {
+        if (verbose) load_arena.fprint_stats(stderr);
+        load_arena.release();
+    }
+    return scene;
+}
 
-    Counter progress_counter = Counter();
+FILE* open_out_file(const char* file_name) {
+    FILE* f = fopen(file_name, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open: \"%s\"\n", file_name);
+        exit(1);
+    }
+    return f;
+}
+
+FrameBuffer render_to_frame_buffer(
+    const CmdArgs& cmd_args,
+    Camera& camera,
+    Scene& scene,
+    Counter& progress_counter,
+    HitCache* cache,
+    HitCacheStats& cache_stats,
+    RasterStats& raster_stats,
+    Heatmap* heatmap,
+    Arena& arena
+) {
+    RGB* buffer = arena.push_array_zero<RGB>(camera.pixels());
+    FrameBuffer frame_buffer = { .buffer = buffer, .width = camera.width, .height = camera.height };
+
+    if (cmd_args.raster) {
+        VisibilityBuffer visibility;
+        bool ok = rasterize(
+            camera, scene, cmd_args.threads, &progress_counter, frame_buffer, visibility, raster_stats, heatmap, arena
+        );
+        if (ok) return frame_buffer;
+        fprintf(stderr, "Rasterization needs a camera looking along z, casting rays instead.\n");
+    }
+
+    i64 setup_start_ns = trace_enabled ? now_ns() : 0;
+    Pixel* pixels = arena.push_array<Pixel>(camera.pixels());
+    i64 i = 0;
+    if (trace_enabled) {
+        int tile_rows = (camera.height + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+        int tile_cols = (camera.width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+        Pixel* tiles = arena.push_array<Pixel>((size_t) tile_rows * tile_cols);
+        for (int row = 0; row < tile_rows; row++) {
+            for (int col = 0; col < tile_cols; col++) {
+                tiles[(i64) row * tile_cols + col] = Pixel { .row = row * TRACE_TILE_SIZE, .col = col * TRACE_TILE_SIZE };
+            }
+        }
+        shuffle_pixels(tiles, (size_t) tile_rows * tile_cols);
+        for (i64 t = 0; t < (i64) tile_rows * tile_cols; t++) {
+            int row_end = tiles[t].row + TRACE_TILE_SIZE < camera.height ? tiles[t].row + TRACE_TILE_SIZE : camera.height;
+            int col_end = tiles[t].col + TRACE_TILE_SIZE < camera.width ? tiles[t].col + TRACE_TILE_SIZE : camera.width;
+            for (int row = tiles[t].row; row < row_end; row++) {
+                for (int col = tiles[t].col; col < col_end; col++) {
+                    pixels[i++] = Pixel { .row = row, .col = col };
+                }
+            }
+        }
+    } else {
+        for (int row = 0; row < camera.height; row++) {
+            for (int col = 0; col < camera.width; col++) {
+                pixels[i++] = Pixel { .row = row, .col = col };
+            }
+        }
+        shuffle_pixels(pixels, camera.pixels());
+    }
+    if (trace_enabled) trace_record("setup", setup_start_ns, now_ns(), -1);
+
+    pthread_t* threads = arena.push_array<pthread_t>(cmd_args.threads);
+    BatchArgs* args = arena.push_array<BatchArgs>(cmd_args.threads);
 
     Pixel* pixel_ptr = pixels;
     for (int i = 0; i < cmd_args.threads; i++) {
-        int pixels_count = camera.pixels() / cmd_args.threads; // TODO: fix if not divisible?
+        i64 pixels_count = camera.pixels() / cmd_args.threads; // TODO: fix if not divisible?
         if (i + 1 == cmd_args.threads) {
             pixels_count = camera.pixels() - (cmd_args.threads - 1) * (camera.pixels() / cmd_args.threads);
         }
         args[i] = {
             .camera = &camera,
-            .triangles = triangles,
-            .normals = normals,
-            .mesh = mesh,
+            .scene = &scene,
             .frame_buffer = frame_buffer,
             .pixels_count = pixels_count,
             .pixels = pixel_ptr,
-            .counter = &progress_counter
+            .counter = &progress_counter,
+            .cache = cache,
+            .cache_stats = {},
+            .heatmap = heatmap
         };
         pthread_create(&threads[i], NULL, process_batch, (void*)(&args[i]));
         pixel_ptr += pixels_count;
     }
 
+    for (int i = 0; i < cmd_args.threads; i++) {
+        pthread_join(threads[i], NULL);
+        cache_stats.add(args[i].cache_stats);
+    }
+
+    return frame_buffer;
+}
+
+// Numbers the frames of a sequence before the extension: out.png becomes
+// out_0001.png.
+void frame_file_name(const char* file_name, int frame, char* result, size_t size) {
+    const char* dot = strrchr(file_name, '.');
+    const char* slash = strrchr(file_name, '/');
+    if (dot == NULL || (slash != NULL && dot < slash)) dot = file_name + strlen(file_name);
+    snprintf(result, size, "%.*s_%04d%s", (int) (dot - file_name), file_name, frame, dot);
+}
+
+// Returns the seconds spent rendering, without setup and writing.
+f64 render_frame(
+    const CmdArgs& cmd_args,
+    char** worker_argv,
+    Camera& camera,
+    Scene& scene,
+    HitCache* cache,
+    HitCacheStats& cache_stats,
+    const char* out_file_name,
+    Arena& frame_arena
+) {
+    Counter progress_counter = Counter();
+
     bool done = false;
     auto status_printer_args = StatusPrinterArgs {
         .counter = &progress_counter,
@@ -365,19 +405,190 @@ int main(int argc, char** argv) {
     pthread_t status_printer_thread;
     pthread_create(&status_printer_thread, NULL, status_printer, (void*)(&status_printer_args));
 
-    for (int i = 0; i < cmd_args.threads; i++) {
-        pthread_join(threads[i], NULL);
+    ImageFormat format = image_format_from_file_name(out_file_name);
+    // The full frame path keeps writing plain text PPM, everything else goes
+    // through the band encoders.
+    bool encoded = cmd_args.band_height > 0 || format != ImageFormat_PPM;
+    FILE* f = NULL;
+    ImageWriter writer = image_writer(format, NULL, camera.width, camera.height);
+    FrameBuffer frame_buffer;
+    RasterStats raster_stats = {};
+    Heatmap heatmap;
+    if (cmd_args.heatmap) heatmap = heatmap_create(camera.width, camera.height, frame_arena);
+
+    PerfCounters perf = {};
+    if (cmd_args.perf) {
+        perf = perf_counters();
+        perf.start();
     }
+    i64 render_start_ns = now_ns();
+    if (cmd_args.band_height > 0) {
+        f = open_out_file(out_file_name);
+        fprintf(stderr, "Streaming result to: \"%s\"\n", out_file_name);
+        writer.file = f;
+        StreamConfig config = {
+            .threads = cmd_args.threads,
+            .band_height = cmd_args.band_height,
+            .window = cmd_args.bands_in_flight
+        };
+        render_streaming(camera, scene, config, &progress_counter, writer, frame_arena);
+    } else if (cmd_args.processes > 0) {
+        RGB* buffer = frame_arena.push_array_zero<RGB>(camera.pixels());
+        frame_buffer = { .buffer = buffer, .width = camera.width, .height = camera.height };
+
+        DistConfig config = { .processes = cmd_args.processes, .worker_argv = worker_argv };
+        if (!render_distributed(config, camera, &progress_counter, frame_buffer, frame_arena)) {
+            exit(1);
+        }
+    } else {
+        frame_buffer = render_to_frame_buffer(
+            cmd_args,
+            camera,
+            scene,
+            progress_counter,
+            cache,
+            cache_stats,
+            raster_stats,
+            cmd_args.heatmap ? &heatmap : NULL,
+            frame_arena
+        );
+    }
+    i64 render_end_ns = now_ns();
+    if (trace_enabled) trace_record("render", render_start_ns, render_end_ns, -1);
+    if (cmd_args.perf) perf.stop();
 
     done = true;
     pthread_join(status_printer_thread, NULL);
+    if (raster_stats.binned > 0) raster_stats.fprint(stderr, camera.pixels());
+    if (cmd_args.perf) {
+        perf.fprint(stderr);
+        perf.release();
+    }
 
-    FILE* f = fopen(cmd_args.out_file_name, "w");
     if (f == NULL) {
-        fprintf(stderr, "Failed to open: \"%s\"\n", cmd_args.out_file_name);
-        exit(1);
+        TRACE_SCOPE("write");
+        f = open_out_file(out_file_name);
+        fprintf(stderr, "Saving result to: \"%s\"\n", out_file_name);
+        if (encoded) {
+            writer.file = f;
+            encode_frame_buffer(writer, frame_buffer, cmd_args.threads, frame_arena);
+        } else {
+            frame_buffer.to_ppm(f);
+        }
     }
-    fprintf(stderr, "Saving result to: \"%s\"\n", cmd_args.out_file_name);
-    frame_buffer.to_ppm(f);
     fclose(f);
+    if (!writer.ok) {
+        fprintf(stderr, "Failed to write: \"%s\"\n", out_file_name);
+        exit(1);
+    }
+    if (encoded) writer.print_stats(stderr);
+
+    if (cmd_args.heatmap) {
+        char heatmap_file_name[CMD_MAX_OUT_FILE_NAME_LEN + 32];
+        snprintf(heatmap_file_name, sizeof(heatmap_file_name), "%s.heat.ppm", out_file_name);
+        fprintf(stderr, "Saving heatmap to: \"%s\"\n", heatmap_file_name);
+        heatmap.fprint_stats(stderr);
+        if (!heatmap.write(heatmap_file_name, cmd_args.threads, frame_arena)) {
+            fprintf(stderr, "Failed to write: \"%s\"\n", heatmap_file_name);
+            exit(1);
+        }
+    }
+    return (render_end_ns - render_start_ns) / 1e9;
+}
+
+int main(int argc, char** argv) {
+    CmdArgs cmd_args;
+    if (!parse_cmd_args(argc, argv, cmd_args)) {
+        return 0;
+    }
+
+    Camera camera = frame_camera(cmd_args, 0);
+
+    if (cmd_args.trace && !cmd_args.worker) {
+        trace_start();
+        trace_thread_name("main");
+    }
+
+    Arena scene_arena = arena_create("scene", SCENE_ARENA_BLOCK_SIZE, true);
+    Arena frame_arena = arena_create("frame", FRAME_ARENA_BLOCK_SIZE, true);
+
+    if (cmd_args.worker) {
+        Scene scene = load_scene(cmd_args, scene_arena, false, NULL);
+        return run_worker(camera, scene, frame_arena);
+    }
+
+    // In distributed mode only the workers load the scene.
+    Scene scene = {};
+    char** worker_argv = NULL;
+    HitCache cache;
+    if (cmd_args.processes == 0) {
+        scene = load_scene(cmd_args, scene_arena, true, cmd_args.hit_cache ? &cache : NULL);
+    } else {
+        worker_argv = scene_arena.push_array<char*>(argc + 2);
+        for (int i = 0; i < argc; i++) worker_argv[i] = argv[i];
+        worker_argv[argc] = (char*) "-W";
+        worker_argv[argc + 1] = NULL;
+    }
+
+    HitCacheStats total_cache_stats = {};
+    f64 render_seconds = 0;
+
+    for (int frame = 0; frame < cmd_args.frames; frame++) {
+        TRACE_SCOPE("frame", frame);
+        frame_arena.reset();
+
+        char out_file_name[CMD_MAX_OUT_FILE_NAME_LEN + 16];
+        if (cmd_args.frames > 1) {
+            frame_file_name(cmd_args.out_file_name, frame, out_file_name, sizeof(out_file_name));
+            camera = frame_camera(cmd_args, frame);
+            if (cmd_args.turntable != 0) pose_scene(scene, frame * cmd_args.turntable * M_PI / 180);
+        } else {
+            strcpy(out_file_name, cmd_args.out_file_name);
+        }
+
+        HitCacheStats cache_stats = {};
+        f64 seconds = render_frame(
+            cmd_args,
+            worker_argv,
+            camera,
+            scene,
+            cmd_args.hit_cache ? &cache : NULL,
+            cache_stats,
+            out_file_name,
+            frame_arena
+        );
+        render_seconds += seconds;
+        total_cache_stats.add(cache_stats);
+
+        if (cmd_args.frames > 1 || cmd_args.hit_cache) {
+            fprintf(stderr, "Frame %d/%d: rendered in %.3fs", frame + 1, cmd_args.frames, seconds);
+            if (cmd_args.hit_cache) {
+                fprintf(stderr, ", ");
+                cache_stats.fprint(stderr);
+            }
+            fprintf(stderr, "\n");
+        }
+    }
+
+    if (cmd_args.hit_cache && cmd_args.frames > 1) {
+        fprintf(stderr, "All %d frames: rendered in %.3fs, ", cmd_args.frames, render_seconds);
+        total_cache_stats.fprint(stderr);
+        fprintf(stderr, "\n");
+    }
+
+    scene_arena.fprint_stats(stderr);
+    frame_arena.fprint_stats(stderr);
+
+    if (cmd_args.trace) {
+        char trace_file_name[CMD_MAX_OUT_FILE_NAME_LEN + 32];
+        snprintf(trace_file_name, sizeof(trace_file_name), "%s.trace.json", cmd_args.out_file_name);
+        fprintf(stderr, "Saving trace to: \"%s\"\n", trace_file_name);
+        if (!trace_write(trace_file_name)) {
+            fprintf(stderr, "Failed to write: \"%s\"\n", trace_file_name);
+            exit(1);
+        }
+    }
+
+    frame_arena.release();
+    scene_arena.release();
 }
@@ -105,31 +105,28 @@ static char read_word(FILE* f, char* buffer, int buffer_size) {
     return true;
 }
 
-static Mesh* mesh_alloc_in_buffer(void* buffer, const MeshInfo& info) {
-    Mesh* mesh = (Mesh*) buffer;
+static Mesh* mesh_alloc_in_arena(Arena& arena, const MeshInfo& info) {
+    Mesh* mesh = arena.push_array<Mesh>(1);
     mesh->vertices_count = info.vertices;
-    mesh->vertices = (Vec3*)(mesh + sizeof(Mesh));
+    mesh->vertices = arena.push_array<Vec3>(info.vertices);
     mesh->normals_count = info.normals;
-    mesh->normals = mesh->vertices + sizeof(Vec3) * mesh->vertices_count;
+    mesh->normals = arena.push_array<Vec3>(info.normals);
     mesh->faces_count = info.faces;
-    mesh->faces = (Face*)(mesh->normals + sizeof(Vec3) * mesh->normals_count);
-    Vec3** gv = (Vec3**)(mesh->faces + sizeof(Face) * mesh->faces_count);
-    Vec3** vn = gv + 3 * sizeof(Vec3*) * mesh->faces_count;
+    mesh->faces = arena.push_array<Face>(info.faces);
+    Vec3** refs = arena.push_array<Vec3*>(2 * 3 * (size_t) info.faces);
     for (int i = 0; i < info.faces; i++) {
-        mesh->faces[i].gv = gv;
-        gv += 3 * sizeof(Vec3*);
-        mesh->faces[i].vn = vn;
-        vn += 3 * sizeof(Vec3*);
+        mesh->faces[i].gv = refs + 6 * i;
+        mesh->faces[i].vn = refs + 6 * i + 3;
     }
     return mesh;
 }
 
-Mesh* Obj::parse(const char* file_name, void* buffer, const MeshInfo& info) {
-    Mesh* mesh = mesh_alloc_in_buffer(buffer, info);
-
+Mesh* Obj::parse(const char* file_name, Arena& arena, const MeshInfo& info) {
     FILE* f = fopen(file_name, "r");
     if (f == NULL) return NULL;
 
+    Mesh* mesh = mesh_alloc_in_arena(arena, info);
+
     int vertices_count = 0;
     int normals_count = 0;
     int faces_count = 0;
@@ -165,3 +162,25 @@ Mesh* Obj::parse(const char* file_name, void* buffer, const MeshInfo& info) {
     fclose(f);
     return mesh;
 }
+
+Mesh* Obj::build(int vertices_count, const Vec3* vertices, int faces_count, const int* corners, Arena& arena) {
+    Mesh* mesh = arena.push_array<Mesh>(1);
+    mesh->vertices_count = vertices_count;
+    mesh->vertices = arena.push_array<Vec3>(vertices_count);
+    memcpy(mesh->vertices, vertices, vertices_count * sizeof(Vec3));
+    mesh->normals_count = 0;
+    mesh->normals = NULL;
+    mesh->faces_count = faces_count;
+    mesh->faces = arena.push_array<Face>(faces_count);
+    Vec3** refs = arena.push_array_zero<Vec3*>(2 * 3 * (size_t) faces_count);
+    for (int i = 0; i < faces_count; i++) {
+        Face& face = mesh->faces[i];
+        face.len = 3;
+        face.gv = refs + 6 * i;
+        face.vn = refs + 6 * i + 3;
+        for (int k = 0; k < 3; k++) {
+            face.gv[k] = &mesh->vertices[corners[3 * i + k]];
+        }
+    }
+    return mesh;
+}
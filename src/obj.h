@@ -4,9 +4,10 @@
 #pragma once
 
 #include <cstddef>
+#include <stdio.h>
+#include "arena.h"
 
 struct Vec3;
-typedef struct __sFILE FILE;
 
 namespace Obj {
     struct Face {
@@ -39,5 +40,9 @@ namespace Obj {
     };
 
     bool calc_memory(const char* file_name, MeshInfo& info);
-    Mesh* parse(const char* file_name, void* buffer, const MeshInfo& info);
+    Mesh* parse(const char* file_name, Arena& arena, const MeshInfo& info);
+
+    // Mesh of triangles given as 3 vertex indices (from 0) each, without
+    // vertex normals.
+    Mesh* build(int vertices_count, const Vec3* vertices, int faces_count, const int* corners, Arena& arena);
 }
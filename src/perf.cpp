@@ -0,0 +1,102 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "perf.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+static const u64 PERF_EVENT_CONFIGS[PerfEvent_Count] = {
+    PERF_COUNT_HW_CACHE_REFERENCES,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_INSTRUCTIONS
+};
+
+static int perf_event_open(u64 config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;  // count the threads started while enabled too
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+PerfCounters perf_counters() {
+    PerfCounters counters = {};
+    for (int i = 0; i < PerfEvent_Count; i++) counters.fds[i] = -1;
+#ifdef __linux__
+    counters.ok = true;
+    for (int i = 0; i < PerfEvent_Count && counters.ok; i++) {
+        counters.fds[i] = perf_event_open(PERF_EVENT_CONFIGS[i]);
+        if (counters.fds[i] < 0) {
+            counters.ok = false;
+            counters.error = strerror(errno);
+        }
+    }
+    if (!counters.ok) {
+        for (int i = 0; i < PerfEvent_Count; i++) {
+            if (counters.fds[i] >= 0) close(counters.fds[i]);
+            counters.fds[i] = -1;
+        }
+    }
+#else
+    counters.error = "perf events are Linux only";
+#endif
+    return counters;
+}
+
+void PerfCounters::start() {
+#ifdef __linux__
+    if (!ok) return;
+    for (int i = 0; i < PerfEvent_Count; i++) {
+        ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+// Threads started in between must have been joined, their counts are only
+// added to ours when they exit.
+void PerfCounters::stop() {
+#ifdef __linux__
+    if (!ok) return;
+    for (int i = 0; i < PerfEvent_Count; i++) {
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+            ok = false;
+            error = "failed to read the counters";
+        }
+    }
+#endif
+}
+
+void PerfCounters::release() {
+    for (int i = 0; i < PerfEvent_Count; i++) {
+        if (fds[i] >= 0) close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+void PerfCounters::fprint(FILE* f) const {
+    if (!ok) {
+        fprintf(f, "Perf: counters unavailable (%s), no cache miss figures for this run\n", error);
+        return;
+    }
+    u64 references = values[PerfEvent_CacheReferences];
+    u64 misses = values[PerfEvent_CacheMisses];
+    fprintf(
+        f,
+        "Perf: %.2fM cache misses of %.2fM references (%.1f%%), %.2fM instructions\n",
+        misses / 1e6,
+        references / 1e6,
+        references > 0 ? 100.0 * misses / references : 0.0,
+        values[PerfEvent_Instructions] / 1e6
+    );
+}
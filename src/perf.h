@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+#include "common.h"
+
+enum PerfEvent {
+    PerfEvent_CacheReferences,
+    PerfEvent_CacheMisses,
+    PerfEvent_Instructions,
+
+    PerfEvent_Count
+};
+
+// Hardware counters through perf_event_open, for the calling thread and
+// every thread it starts while they run. Where the counters aren't
+// available (no kernel support, perf_event_paranoid, containers) `ok` is
+// false and `error` says why; rendering goes on without them.
+struct PerfCounters {
+    int fds[PerfEvent_Count];
+    bool ok;
+    const char* error;
+    u64 values[PerfEvent_Count];
+
+    void start();
+    void stop();
+    void release();
+    void fprint(FILE* f) const;
+};
+
+PerfCounters perf_counters();
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include "png.h"
+#include "deflate.h"
+
+struct CrcTable {
+    u32 values[256];
+
+    CrcTable() {
+        for (u32 n = 0; n < 256; n++) {
+            u32 c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            values[n] = c;
+        }
+    }
+};
+
+static const CrcTable CRC_TABLE;
+
+static u32 crc32(const u8* data, size_t size) {
+    u32 c = 0xffffffffu;
+    for (size_t i = 0; i < size; i++) {
+        c = CRC_TABLE.values[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffffu;
+}
+
+// Chunks are built in place: `chunk_begin` leaves room for the length,
+// the data is appended and `chunk_end` patches the length and adds the CRC.
+static size_t chunk_begin(ByteBuffer& out, const char* type) {
+    size_t start = out.size;
+    out.push_u32_be(0);
+    out.append((const u8*) type, 4);
+    return start;
+}
+
+static void chunk_end(ByteBuffer& out, size_t start) {
+    u32 length = (u32)(out.size - start - 8);
+    out.data[start + 0] = (u8)(length >> 24);
+    out.data[start + 1] = (u8)(length >> 16);
+    out.data[start + 2] = (u8)(length >> 8);
+    out.data[start + 3] = (u8) length;
+    out.push_u32_be(crc32(out.data + start + 4, length + 4));
+}
+
+void png_header(ByteBuffer& out, int width, int height) {
+    static const u8 SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.append(SIGNATURE, 8);
+
+    size_t ihdr = chunk_begin(out, "IHDR");
+    out.push_u32_be(width);
+    out.push_u32_be(height);
+    out.push(8);  // bit depth
+    out.push(2);  // color type: truecolor
+    out.push(0);  // compression method: deflate
+    out.push(0);  // filter method: adaptive
+    out.push(0);  // interlace method: none
+    chunk_end(out, ihdr);
+
+    // zlib header: deflate with a 32K window, no preset dictionary.
+    size_t idat = chunk_begin(out, "IDAT");
+    out.push(0x78);
+    out.push(0x01);
+    chunk_end(out, idat);
+}
+
+static inline u8 paeth(u8 a, u8 b, u8 c) {
+    int p = (int) a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// Picks the filter with the smallest sum of absolute differences. The first
+// row of a band has no previous row available, it is compressed separately
+// from the band above, so only None and Sub are tried there.
+static void filter_row(const u8* row, const u8* prev, int size, u8* candidate, u8* out) {
+    const int bpp = 3;
+    int filters = prev != NULL ? 5 : 2;
+    u32 best_cost = 0xffffffffu;
+    for (int filter = 0; filter < filters; filter++) {
+        u32 cost = 0;
+        for (int i = 0; i < size; i++) {
+            u8 a = i >= bpp ? row[i - bpp] : 0;
+            u8 b = prev != NULL ? prev[i] : 0;
+            u8 c = prev != NULL && i >= bpp ? prev[i - bpp] : 0;
+            u8 v = row[i];
+            switch (filter) {
+            case 1: v -= a; break;
+            case 2: v -= b; break;
+            case 3: v -= (u8)(((int) a + b) / 2); break;
+            case 4: v -= paeth(a, b, c); break;
+            }
+            candidate[i] = v;
+            cost += v < 128 ? v : 256 - v;
+        }
+        if (cost < best_cost) {
+            best_cost = cost;
+            out[0] = (u8) filter;
+            memcpy(out + 1, candidate, size);
+        }
+    }
+}
+
+PngEncoder png_encoder(int width, int height, Arena& arena) {
+    size_t row_size = 3 * (size_t) width;
+    return PngEncoder {
+        .raw = arena.push_array<u8>((row_size + 1) * height),
+        .line = arena.push_array<u8>(row_size),
+        .prev_line = arena.push_array<u8>(row_size),
+        .candidate = arena.push_array<u8>(row_size),
+        .deflater = deflater_create(arena)
+    };
+}
+
+void png_band(PngEncoder& encoder, ByteBuffer& out, FrameBuffer& rows, u32& adler, size_t& raw_size) {
+    int row_size = 3 * rows.width;
+    raw_size = (size_t)(row_size + 1) * rows.height;
+    u8* raw = encoder.raw;
+    u8* line = encoder.line;
+    u8* prev_line = encoder.prev_line;
+    u8* candidate = encoder.candidate;
+
+    for (int row = 0; row < rows.height; row++) {
+        for (int col = 0; col < rows.width; col++) {
+            RGB color = rows.get(row, col);
+            line[3*col + 0] = color.get_red();
+            line[3*col + 1] = color.get_green();
+            line[3*col + 2] = color.get_blue();
+        }
+        filter_row(line, row > 0 ? prev_line : NULL, row_size, candidate, raw + (size_t) row * (row_size + 1));
+        u8* t = prev_line;
+        prev_line = line;
+        line = t;
+    }
+
+    adler = adler32(1, raw, raw_size);
+    size_t idat = chunk_begin(out, "IDAT");
+    deflate_chunk(*encoder.deflater, raw, raw_size, out);
+    chunk_end(out, idat);
+}
+
+void png_trailer(ByteBuffer& out, u32 adler) {
+    size_t idat = chunk_begin(out, "IDAT");
+    deflate_finish(out);
+    out.push_u32_be(adler);
+    chunk_end(out, idat);
+
+    size_t iend = chunk_begin(out, "IEND");
+    chunk_end(out, iend);
+}
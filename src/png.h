@@ -0,0 +1,32 @@
+// PNG format documentation:
+//     https://www.w3.org/TR/png/
+
+#pragma once
+
+#include "common.h"
+#include "byte_buffer.h"
+#include "frame.h"
+#include "arena.h"
+#include "deflate.h"
+
+// A PNG is written as a signature and IHDR, then one IDAT chunk per band of
+// rows and finally a trailer closing the zlib stream. Bands are filtered and
+// deflated independently, so any number of them can be encoded in parallel.
+void png_header(ByteBuffer& out, int width, int height);
+
+// Working memory of `png_band` for bands of up to `height` rows of `width`
+// pixels, used by one thread at a time.
+struct PngEncoder {
+    u8* raw;        // filtered scanlines of the band
+    u8* line;
+    u8* prev_line;
+    u8* candidate;  // the row under the filter being tried
+    Deflater* deflater;
+};
+
+PngEncoder png_encoder(int width, int height, Arena& arena);
+
+// Appends a complete IDAT chunk and returns the Adler-32 of the band's
+// uncompressed scanlines through `adler` and `raw_size`.
+void png_band(PngEncoder& encoder, ByteBuffer& out, FrameBuffer& rows, u32& adler, size_t& raw_size);
+void png_trailer(ByteBuffer& out, u32 adler);
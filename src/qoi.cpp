@@ -0,0 +1,92 @@
+#include "qoi.h"
+
+static const u8 QOI_OP_INDEX = 0x00;
+static const u8 QOI_OP_DIFF  = 0x40;
+static const u8 QOI_OP_LUMA  = 0x80;
+static const u8 QOI_OP_RUN   = 0xc0;
+static const u8 QOI_OP_RGB   = 0xfe;
+
+static const int QOI_MAX_RUN = 62;
+
+// The image is opaque, so colors are kept without the alpha channel and the
+// hash uses a = 255. Entries start as -1, which never equals a color.
+static inline int qoi_hash(i32 color) {
+    int r = (color >> 16) & 0xff;
+    int g = (color >> 8) & 0xff;
+    int b = color & 0xff;
+    return (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+}
+
+void qoi_header(ByteBuffer& out, int width, int height) {
+    out.append((const u8*) "qoif", 4);
+    out.push_u32_be(width);
+    out.push_u32_be(height);
+    out.push(3);  // channels: RGB
+    out.push(0);  // colorspace: sRGB with linear alpha
+}
+
+void qoi_band(ByteBuffer& out, FrameBuffer& rows) {
+    i32 index[64];
+    for (int i = 0; i < 64; i++) index[i] = -1;
+
+    bool has_prev = false;
+    i32 prev = 0;
+    int run = 0;
+    for (int row = 0; row < rows.height; row++) {
+        for (int col = 0; col < rows.width; col++) {
+            i32 color = rows.get(row, col).mem;
+
+            if (has_prev && color == prev) {
+                run++;
+                if (run == QOI_MAX_RUN) {
+                    out.push(QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out.push(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+
+            int hash = qoi_hash(color);
+            int r = (color >> 16) & 0xff;
+            int g = (color >> 8) & 0xff;
+            int b = color & 0xff;
+            if (index[hash] == color) {
+                out.push(QOI_OP_INDEX | hash);
+            } else {
+                index[hash] = color;
+                i8 dr = (i8)(r - ((prev >> 16) & 0xff));
+                i8 dg = (i8)(g - ((prev >> 8) & 0xff));
+                i8 db = (i8)(b - (prev & 0xff));
+                i8 dr_dg = dr - dg;
+                i8 db_dg = db - dg;
+                if (!has_prev) {
+                    out.push(QOI_OP_RGB);
+                    out.push(r);
+                    out.push(g);
+                    out.push(b);
+                } else if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                    out.push(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                } else if (dg > -33 && dg < 32 && dr_dg > -9 && dr_dg < 8 && db_dg > -9 && db_dg < 8) {
+                    out.push(QOI_OP_LUMA | (dg + 32));
+                    out.push((dr_dg + 8) << 4 | (db_dg + 8));
+                } else {
+                    out.push(QOI_OP_RGB);
+                    out.push(r);
+                    out.push(g);
+                    out.push(b);
+                }
+            }
+            has_prev = true;
+            prev = color;
+        }
+    }
+    if (run > 0) out.push(QOI_OP_RUN | (run - 1));
+}
+
+void qoi_trailer(ByteBuffer& out) {
+    static const u8 END_MARKER[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    out.append(END_MARKER, 8);
+}
@@ -0,0 +1,15 @@
+// QOI format documentation:
+//     https://qoiformat.org/qoi-specification.pdf
+
+#pragma once
+
+#include "common.h"
+#include "byte_buffer.h"
+#include "frame.h"
+
+// Bands are encoded without knowing the pixels before them: a band starts
+// with a full QOI_OP_RGB and only refers to color index entries set inside
+// the band, so the decoder sees the same stream as from a serial encoder.
+void qoi_header(ByteBuffer& out, int width, int height);
+void qoi_band(ByteBuffer& out, FrameBuffer& rows);
+void qoi_trailer(ByteBuffer& out);
@@ -0,0 +1,318 @@
+#include <math.h>
+#include <pthread.h>
+#include "raster.h"
+#include "trace.h"
+
+const int RASTER_BIN_SIZE = 64;
+
+// Pixel centers this close to a triangle's projected bounds are still
+// tested, which covers rounding in the projection.
+const f64 RASTER_MARGIN = 1e-3;
+
+// Vertices nearer to the camera plane than this (the image plane is at 1)
+// are not projected, their triangles are tested in every bin.
+const f64 RASTER_NEAR = 1e-6;
+
+// Keeps the depth test conservative for hits right at a vertex.
+const f64 RASTER_DEPTH_SLACK = 1e-9;
+
+// The ray of pixel (row, col) points along d0 + col * col_step * x +
+// row * row_step * y, so a point's distance along any pixel's ray only
+// depends on its z, and its pixel coordinates follow from dividing by it.
+struct Projection {
+    Point3 origin;
+    Vec3 d0;
+    f64 col_step;
+    f64 row_step;
+
+    inline f64 depth(const Point3& p) const {
+        return (p.z - origin.z) / d0.z;
+    }
+
+    inline void pixel(const Point3& p, f64 depth, f64& col, f64& row) const {
+        col = ((p.x - origin.x) / depth - d0.x) / col_step;
+        row = ((p.y - origin.y) / depth - d0.y) / row_step;
+    }
+};
+
+struct RasterTriangle {
+    int index;
+    int col0, col1;  // inclusive pixel bounds
+    int row0, row1;
+    f64 min_depth;
+};
+
+struct RasterQueue {
+    const Camera* camera;
+    const Scene* scene;
+    Counter* counter;
+    FrameBuffer* frame_buffer;
+    VisibilityBuffer* visibility;
+    Heatmap* heatmap;
+
+    RasterTriangle* triangles;
+    int bins_x;
+    int bins_count;
+    int* bin_starts;  // bins_count + 1 offsets into bin_triangles
+    int* bin_triangles;
+
+    pthread_mutex_t mutex;
+    int next_bin;
+    i64 tests;
+};
+
+static int clamp_to_int(f64 v, int lo, int hi) {
+    if (!(v > lo)) return lo;
+    if (v > hi) return hi;
+    return (int) v;
+}
+
+// Returns false if the triangle can't be seen.
+static bool bound_triangle(
+    const Projection& projection,
+    const Camera& camera,
+    const Triangle& triangle,
+    RasterTriangle& result,
+    RasterStats& stats
+) {
+    const Point3* p[3] = { &triangle.a, &triangle.b, &triangle.c };
+    f64 depths[3];
+    f64 min_depth = F64_INF;
+    f64 max_depth = -F64_INF;
+    for (int k = 0; k < 3; k++) {
+        depths[k] = projection.depth(*p[k]);
+        min_depth = fmin(min_depth, depths[k]);
+        max_depth = fmax(max_depth, depths[k]);
+    }
+
+    if (max_depth < 0) {
+        stats.behind++;
+        return false;
+    }
+    if (min_depth < RASTER_NEAR) {
+        stats.crossing++;
+        result.col0 = 0;
+        result.col1 = camera.width - 1;
+        result.row0 = 0;
+        result.row1 = camera.height - 1;
+        result.min_depth = 0;
+        return true;
+    }
+
+    f64 min_col = F64_INF, max_col = -F64_INF;
+    f64 min_row = F64_INF, max_row = -F64_INF;
+    for (int k = 0; k < 3; k++) {
+        f64 col, row;
+        projection.pixel(*p[k], depths[k], col, row);
+        min_col = fmin(min_col, col);
+        max_col = fmax(max_col, col);
+        min_row = fmin(min_row, row);
+        max_row = fmax(max_row, row);
+    }
+    min_col = ceil(min_col - RASTER_MARGIN);
+    max_col = floor(max_col + RASTER_MARGIN);
+    min_row = ceil(min_row - RASTER_MARGIN);
+    max_row = floor(max_row + RASTER_MARGIN);
+    if (max_col < 0 || min_col > camera.width - 1 || max_row < 0 || min_row > camera.height - 1) {
+        stats.outside++;
+        return false;
+    }
+
+    result.col0 = clamp_to_int(min_col, 0, camera.width - 1);
+    result.col1 = clamp_to_int(max_col, 0, camera.width - 1);
+    result.row0 = clamp_to_int(min_row, 0, camera.height - 1);
+    result.row1 = clamp_to_int(max_row, 0, camera.height - 1);
+    result.min_depth = min_depth * (1 - RASTER_DEPTH_SLACK);
+    return true;
+}
+
+static void raster_bin(RasterQueue& queue, int bin, i64& tests) {
+    TRACE_SCOPE("bin", bin);
+    i64 start_ns = queue.heatmap != NULL ? thread_now_ns() : 0;
+    const Camera& camera = *queue.camera;
+    const Scene& scene = *queue.scene;
+    VisibilityBuffer& visibility = *queue.visibility;
+
+    int col0 = (bin % queue.bins_x) * RASTER_BIN_SIZE;
+    int row0 = (bin / queue.bins_x) * RASTER_BIN_SIZE;
+    int col1 = col0 + RASTER_BIN_SIZE < camera.width ? col0 + RASTER_BIN_SIZE : camera.width;
+    int row1 = row0 + RASTER_BIN_SIZE < camera.height ? row0 + RASTER_BIN_SIZE : camera.height;
+
+    for (int row = row0; row < row1; row++) {
+        for (int col = col0; col < col1; col++) {
+            i64 p = (i64) row * camera.width + col;
+            visibility.triangles[p] = -1;
+            visibility.depths[p] = F64_INF;
+        }
+    }
+
+    for (int k = queue.bin_starts[bin]; k < queue.bin_starts[bin + 1]; k++) {
+        const RasterTriangle& rt = queue.triangles[queue.bin_triangles[k]];
+        int i = rt.index;
+        int r0 = rt.row0 > row0 ? rt.row0 : row0;
+        int r1 = rt.row1 < row1 - 1 ? rt.row1 : row1 - 1;
+        int c0 = rt.col0 > col0 ? rt.col0 : col0;
+        int c1 = rt.col1 < col1 - 1 ? rt.col1 : col1 - 1;
+        for (int row = r0; row <= r1; row++) {
+            for (int col = c0; col <= c1; col++) {
+                i64 p = (i64) row * camera.width + col;
+                f64& depth = visibility.depths[p];
+                int& hit = visibility.triangles[p];
+                if (rt.min_depth > depth) continue;
+
+                tests++;
+                f64 t = hit_triangle(scene.triangles[i], scene.normals[i], camera.pixel_ray(row, col));
+                // Same order as trace_ray: by distance, then by index.
+                if (t > 0 && (t < depth || (t == depth && i < hit))) {
+                    depth = t;
+                    hit = i;
+                }
+            }
+        }
+    }
+
+    for (int row = row0; row < row1; row++) {
+        for (int col = col0; col < col1; col++) {
+            int hit = visibility.triangles[(i64) row * camera.width + col];
+            queue.frame_buffer->set(row, col, hit >= 0 ? get_rand_color(hit) : RGB());
+        }
+    }
+    queue.counter->inc((i64) (row1 - row0) * (col1 - col0));
+    if (queue.heatmap != NULL) {
+        queue.heatmap->add_tile(row0, row1, col0, col1, thread_now_ns() - start_ns);
+    }
+}
+
+static void* raster_worker(void* arg) {
+    RasterQueue& queue = *(RasterQueue*) arg;
+    trace_thread_name("raster");
+    i64 tests = 0;
+    while (true) {
+        pthread_mutex_lock(&queue.mutex);
+        int bin = queue.next_bin++;
+        pthread_mutex_unlock(&queue.mutex);
+        if (bin >= queue.bins_count) break;
+        raster_bin(queue, bin, tests);
+    }
+    pthread_mutex_lock(&queue.mutex);
+    queue.tests += tests;
+    pthread_mutex_unlock(&queue.mutex);
+    return NULL;
+}
+
+bool rasterize(
+    const Camera& camera,
+    const Scene& scene,
+    int threads,
+    Counter* counter,
+    FrameBuffer& frame_buffer,
+    VisibilityBuffer& visibility,
+    RasterStats& stats,
+    Heatmap* heatmap,
+    Arena& arena
+) {
+    TRACE_SCOPE("rasterize");
+    Projection projection = {
+        .origin = camera.origin,
+        .d0 = camera.pixel_ray(0, 0).direction,
+        .col_step = -camera.viewport_width_d.x,
+        .row_step = -camera.viewport_height_d.y
+    };
+    if (projection.d0.z == 0) return false;
+
+    stats = {};
+    visibility = VisibilityBuffer {
+        .width = camera.width,
+        .height = camera.height,
+        .triangles = arena.push_array<int>(camera.pixels()),
+        .depths = arena.push_array<f64>(camera.pixels())
+    };
+
+    i64 setup_start_ns = trace_enabled ? now_ns() : 0;
+    // Front faces first, so that the back faces behind them mostly fail the
+    // depth test.
+    RasterTriangle* triangles = arena.push_array<RasterTriangle>(scene.triangles_count);
+    int triangles_count = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < scene.triangles_count; i++) {
+            const Triangle& triangle = scene.triangles[i];
+            bool front = vec3_dot(scene.normals[i], triangle.a - camera.origin) < 0;
+            if (front != (pass == 0)) continue;
+
+            RasterTriangle& rt = triangles[triangles_count];
+            if (!bound_triangle(projection, camera, triangle, rt, stats)) continue;
+            rt.index = i;
+            triangles_count++;
+            if (!front) stats.back_faces++;
+        }
+    }
+    stats.binned = triangles_count;
+
+    int bins_x = (camera.width + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+    int bins_y = (camera.height + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+    int bins_count = bins_x * bins_y;
+    int* bin_starts = arena.push_array_zero<int>(bins_count + 1);
+    for (int k = 0; k < triangles_count; k++) {
+        const RasterTriangle& rt = triangles[k];
+        for (int by = rt.row0 / RASTER_BIN_SIZE; by <= rt.row1 / RASTER_BIN_SIZE; by++) {
+            for (int bx = rt.col0 / RASTER_BIN_SIZE; bx <= rt.col1 / RASTER_BIN_SIZE; bx++) {
+                bin_starts[by * bins_x + bx + 1]++;
+            }
+        }
+    }
+    for (int b = 0; b < bins_count; b++) bin_starts[b + 1] += bin_starts[b];
+
+    int* bin_fill = arena.push_array<int>(bins_count);
+    for (int b = 0; b < bins_count; b++) bin_fill[b] = bin_starts[b];
+    int* bin_triangles = arena.push_array<int>(bin_starts[bins_count]);
+    for (int k = 0; k < triangles_count; k++) {
+        const RasterTriangle& rt = triangles[k];
+        for (int by = rt.row0 / RASTER_BIN_SIZE; by <= rt.row1 / RASTER_BIN_SIZE; by++) {
+            for (int bx = rt.col0 / RASTER_BIN_SIZE; bx <= rt.col1 / RASTER_BIN_SIZE; bx++) {
+                bin_triangles[bin_fill[by * bins_x + bx]++] = k;
+            }
+        }
+    }
+
+    if (trace_enabled) trace_record("bin triangles", setup_start_ns, now_ns(), -1);
+    RasterQueue queue = {
+        .camera = &camera,
+        .scene = &scene,
+        .counter = counter,
+        .frame_buffer = &frame_buffer,
+        .visibility = &visibility,
+        .heatmap = heatmap,
+        .triangles = triangles,
+        .bins_x = bins_x,
+        .bins_count = bins_count,
+        .bin_starts = bin_starts,
+        .bin_triangles = bin_triangles,
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .next_bin = 0,
+        .tests = 0
+    };
+
+    pthread_t* thread_ids = arena.push_array<pthread_t>(threads);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&thread_ids[i], NULL, raster_worker, (void*)(&queue));
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(thread_ids[i], NULL);
+    }
+    stats.tests = queue.tests;
+    return true;
+}
+
+void RasterStats::fprint(FILE* f, i64 pixels) const {
+    fprintf(
+        f,
+        "Raster: %lld triangles binned (%lld back faces), %lld behind the camera, "
+        "%lld outside the frustum, %lld crossing the camera plane; %.2f exact tests per pixel\n",
+        (long long) binned,
+        (long long) back_faces,
+        (long long) behind,
+        (long long) outside,
+        (long long) crossing,
+        pixels > 0 ? (f64) tests / pixels : 0.0
+    );
+}
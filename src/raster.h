@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdio.h>
+#include "render.h"
+#include "frame.h"
+#include "arena.h"
+#include "heatmap.h"
+
+// Per pixel result of the primary visibility pass.
+struct VisibilityBuffer {
+    int width;
+    int height;
+    int* triangles;  // closest triangle, -1 for a miss
+    f64* depths;     // its distance along the pixel's ray, F64_INF for a miss
+};
+
+struct RasterStats {
+    i64 binned;     // triangles that overlap the screen
+    i64 behind;     // culled, entirely behind the camera
+    i64 outside;    // culled, projected outside the frustum
+    i64 crossing;   // cross the camera plane, tested against every pixel
+    i64 back_faces; // binned triangles facing away from the camera
+    i64 tests;      // exact ray-triangle tests
+
+    void fprint(FILE* f, i64 pixels) const;
+};
+
+// Primary visibility by rasterization instead of casting every pixel's ray
+// against every triangle. Triangles are projected through the camera,
+// culled against the frustum and sorted into screen bins, which the
+// threads z-buffer independently. Within a bin, pixels under a triangle's
+// projected bounds are resolved with the exact `hit_triangle` test, and a
+// triangle farther than the pixel's current depth is skipped without it.
+//
+// The result, written into `frame_buffer` and `visibility`, is the same as
+// ray casting would give. For that reason back faces are not dropped
+// (`hit_triangle` is two-sided), but binned after the front faces, where
+// the depth test rejects almost all of them.
+//
+// With a `heatmap`, each bin's time is added to its pixels.
+//
+// Returns false without rendering if the camera does not look along z,
+// which the projection relies on.
+bool rasterize(
+    const Camera& camera,
+    const Scene& scene,
+    int threads,
+    Counter* counter,
+    FrameBuffer& frame_buffer,
+    VisibilityBuffer& visibility,
+    RasterStats& stats,
+    Heatmap* heatmap,
+    Arena& arena
+);
@@ -0,0 +1,120 @@
+#include <math.h>
+#include "render.h"
+#include "bvh.h"
+
+Vec3 triangle_normal(Triangle triangle) {
+    Vec3 A = triangle.b - triangle.a;
+    Vec3 B = triangle.c - triangle.a;
+    return vec3_cross(A, B);
+}
+
+f64 hit_triangle(const Triangle& triangle, const Vec3& n, const Ray& ray) {
+    f64 t = hit_plane(triangle, n, ray);
+    if (t < 0) return -1;
+    return inside_triangle(triangle, n, ray, t) ? t : -1;
+}
+
+Vec3 mesh_center(const Obj::Mesh& mesh) {
+    Vec3 lo = { .x = F64_INF, .y = F64_INF, .z = F64_INF };
+    Vec3 hi = -lo;
+    for (int i = 0; i < mesh.vertices_count; i++) {
+        Vec3 v = mesh.vertices[i];
+        lo = Vec3 { .x = fmin(lo.x, v.x), .y = fmin(lo.y, v.y), .z = fmin(lo.z, v.z) };
+        hi = Vec3 { .x = fmax(hi.x, v.x), .y = fmax(hi.y, v.y), .z = fmax(hi.z, v.z) };
+    }
+    return 0.5 * (lo + hi);
+}
+
+void pose_scene(Scene& scene, f64 angle) {
+    if (scene.bvh != NULL) {
+        bvh_pose(*scene.bvh, angle);
+        return;
+    }
+    const Obj::Mesh& mesh = *scene.mesh;
+    Vec3 center = mesh_center(mesh);
+    f64 c = cos(angle);
+    f64 s = sin(angle);
+
+    for (int i = 0; i < scene.triangles_count; i++) {
+        Point3 p[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = *mesh.faces[i].gv[k];
+            // Leave the unrotated mesh bit for bit as it was loaded.
+            if (angle != 0) p[k] = turntable_point(p[k], center, c, s);
+        }
+        scene.triangles[i] = Triangle { .a = p[0], .b = p[1], .c = p[2] };
+        // TODO: use precalculated normals when available
+        scene.normals[i] = triangle_normal(scene.triangles[i]);
+    }
+}
+
+RGB get_rand_color(int i) {
+    static RGB colors[] = {
+        RGB(125, 125, 125),
+        RGB(185, 185, 185),
+        // RGB(255, 0, 0),
+        // RGB(0, 255, 0),
+        // RGB(0, 0, 255),
+        // RGB(255, 255, 0),
+        // RGB(0, 255, 255),
+        // RGB(255, 0, 255),
+        // RGB(60, 60, 60),
+        // RGB(255, 255, 255)
+    };
+    return colors[i%2];
+}
+
+int trace_ray(const Scene& scene, const Ray& ray) {
+    return trace_ray_bounded(scene, ray, F64_INF, -1, NULL);
+}
+
+int trace_ray_bounded(const Scene& scene, const Ray& ray, f64 best_t, int best_i, TraceStats* stats) {
+    if (scene.bvh != NULL) return bvh_trace(*scene.bvh, ray, best_t, best_i, stats);
+    i64 culled = 0;
+    for (int i = 0; i < scene.triangles_count; i++) {
+        f64 t = hit_plane(scene.triangles[i], scene.normals[i], ray);
+        if (t <= 0) continue;
+        // The plane is farther than the best hit so far, skip the edge tests.
+        if (!closer_hit(t, i, best_t, best_i)) {
+            culled++;
+            continue;
+        }
+        if (inside_triangle(scene.triangles[i], scene.normals[i], ray, t)) {
+            best_t = t;
+            best_i = i;
+        }
+    }
+    if (stats != NULL) {
+        stats->rays++;
+        stats->triangles += scene.triangles_count;
+        stats->culled += culled;
+    }
+    return best_i;
+}
+
+int trace_ray_candidates(
+    const Scene& scene,
+    const Ray& ray,
+    const int* candidates,
+    int candidates_count,
+    f64& best_t
+) {
+    int best_i = -1;
+    best_t = F64_INF;
+    for (int k = 0; k < candidates_count; k++) {
+        int i = candidates[k];
+        if (i < 0) continue;
+        f64 t;
+        if (scene.bvh != NULL) {
+            Triangle triangle = bvh_triangle(*scene.bvh, i);
+            t = hit_triangle(triangle, triangle_normal(triangle), ray);
+        } else {
+            t = hit_triangle(scene.triangles[i], scene.normals[i], ray);
+        }
+        if (t > 0 && closer_hit(t, i, best_t, best_i)) {
+            best_t = t;
+            best_i = i;
+        }
+    }
+    return best_i;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stdio.h>
+#include <pthread.h>
+#include "common.h"
+#include "vec3.h"
+#include "frame.h"
+#include "obj.h"
+
+using Point3 = Vec3;
+
+struct Triangle {
+    Point3 a, b, c;
+};
+
+Vec3 triangle_normal(Triangle triangle);
+
+struct Ray {
+    Point3 origin;
+    Vec3 direction;
+
+    void print() {
+        fprint(stdout);
+    }
+
+    void fprint(FILE *f) {
+        fprintf(f, "Ray<origin: ");
+        origin.fprint(f);
+        fprintf(f, ", direction: ");
+        direction.fprint(f);
+        fprintf(f, ">");
+    }
+};
+
+// Distance along the ray to the triangle's plane, -1 when the ray is
+// parallel to it or the plane is behind the origin.
+inline f64 hit_plane(const Triangle& triangle, const Vec3& n, const Ray& ray) {
+    f64 n_dot_d = vec3_dot(ray.direction, n);
+    if (n_dot_d == 0) return -1;
+
+    f64 d = -vec3_dot(n, triangle.a);
+    f64 t = -(vec3_dot(n, ray.origin) + d) / n_dot_d;
+    if (t < 0) return -1;
+    return t;
+}
+
+// Whether the point at distance `t` along the ray is inside the triangle.
+inline bool inside_triangle(const Triangle& triangle, const Vec3& n, const Ray& ray, f64 t) {
+    Point3 p = ray.origin + t * ray.direction;
+
+    Vec3 e0 = triangle.b - triangle.a;
+    Vec3 e1 = triangle.c - triangle.b;
+    Vec3 e2 = triangle.a - triangle.c;
+    return (
+        vec3_dot(n, vec3_cross(e0, p - triangle.a)) > 0 &&
+        vec3_dot(n, vec3_cross(e1, p - triangle.b)) > 0 &&
+        vec3_dot(n, vec3_cross(e2, p - triangle.c)) > 0
+    );
+}
+
+f64 hit_triangle(const Triangle& triangle, const Vec3& n, const Ray& ray);
+
+RGB get_rand_color(int i);
+
+struct Counter {
+    i64 val;
+    pthread_mutex_t mutex;
+
+    Counter(i64 val = 0) : val(val) {
+        mutex = PTHREAD_MUTEX_INITIALIZER;
+    }
+
+    void inc(i64 v) {
+        pthread_mutex_lock(&mutex);
+        val += v;
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+struct Camera {
+    int height;
+    int width;
+    Point3 top_left_pixel;
+    Point3 origin;
+    Vec3 viewport_width_d;
+    Vec3 viewport_height_d;
+
+    Camera(
+        int height,
+        int width,
+        const Vec3& origin,
+        const Vec3& focal_offset
+    ) : height(height), width(width), origin(origin) {
+        f64 aspect_ratio = ((f64)width) / height;
+
+        f64 viewport_width = 2.0;
+        Vec3 viewport_width_v = Vec3 { .x = viewport_width };
+        f64 viewport_height = viewport_width / aspect_ratio;
+        Vec3 viewport_height_v = Vec3 { .y = viewport_height };
+
+        top_left_pixel = (
+            origin - focal_offset + viewport_width_v/2 + viewport_height_v/2
+        );
+
+        viewport_width_d = Vec3 { .x = viewport_width / width };
+        viewport_height_d = Vec3 { .y = viewport_height / height };
+    }
+
+    inline i64 pixels() const { return (i64) height * width; }
+
+    inline Ray pixel_ray(int row, int col) const {
+        Point3 curr = top_left_pixel - 0.5 * viewport_width_d - row * viewport_height_d - col * viewport_width_d;
+        return Ray { .origin = origin, .direction = curr - origin };
+    }
+};
+
+struct Bvh;
+
+struct Scene {
+    int triangles_count;
+    Triangle* triangles;
+    Vec3* normals;
+    const Obj::Mesh* mesh;  // the triangles are the mesh's faces, in order
+    Bvh* bvh;               // holds the triangles instead of the arrays and mesh above, NULL if not built
+};
+
+// Places the mesh's faces in the scene rotated by `angle` radians about the
+// vertical axis through the center of its bounding box (a turntable).
+void pose_scene(Scene& scene, f64 angle);
+
+// Center of the bounding box of all the mesh's vertices, used or not.
+Vec3 mesh_center(const Obj::Mesh& mesh);
+
+// `p` rotated about the vertical axis through `center`, by the angle with
+// cosine `c` and sine `s`.
+inline Point3 turntable_point(const Point3& p, const Vec3& center, f64 c, f64 s) {
+    Vec3 r = p - center;
+    return center + Vec3 { .x = c * r.x + s * r.z, .y = r.y, .z = c * r.z - s * r.x };
+}
+
+// Hits are ordered by distance and then by index, the same order in which
+// a front to back scan over the triangles keeps the first closest hit.
+inline bool closer_hit(f64 t, int i, f64 best_t, int best_i) {
+    return t < best_t || (t == best_t && i < best_i);
+}
+
+struct TraceStats {
+    i64 rays;
+    i64 triangles;  // triangles considered
+    i64 culled;     // of those, rejected by distance before the edge tests
+};
+
+// Index of the closest triangle hit by the ray or -1 if nothing was hit.
+int trace_ray(const Scene& scene, const Ray& ray);
+
+// Same as `trace_ray`, but starts from a known hit `best_i` at `best_t`
+// (-1 and F64_INF for none), which lets it cull triangles behind it early.
+// The result is the same as without the bound. `stats` may be NULL.
+int trace_ray_bounded(const Scene& scene, const Ray& ray, f64 best_t, int best_i, TraceStats* stats);
+
+// Closest hit among the listed triangles (entries of -1 are skipped), its
+// distance is returned through `best_t`. With a hierarchy the triangles
+// are looked up by id, see `bvh_index`.
+int trace_ray_candidates(
+    const Scene& scene,
+    const Ray& ray,
+    const int* candidates,
+    int candidates_count,
+    f64& best_t
+);
@@ -0,0 +1,462 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simplify.h"
+
+// Levels stop halving below this many triangles.
+const int LOD_MIN_TRIANGLES = 8;
+
+// Weight of the planes that hold open edges in place, relative to a face.
+const f64 LOD_BOUNDARY_WEIGHT = 10;
+
+// Sum of squared distances to a set of planes, as a symmetric 4x4 matrix.
+struct Quadric {
+    f64 a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+    void add_plane(const Vec3& n, f64 d, f64 w) {
+        a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+        b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+        c2 += w * n.z * n.z; cd += w * n.z * d;
+        d2 += w * d * d;
+    }
+
+    void add(const Quadric& q) {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+    }
+
+    f64 error(const Vec3& p) const {
+        return (
+            a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x +
+            b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y +
+            c2 * p.z * p.z + 2 * cd * p.z +
+            d2
+        );
+    }
+
+    // Point of least error, false if it is not well defined (flat or
+    // straight neighbourhoods).
+    bool minimum(Vec3& p) const {
+        f64 det = (
+            a2 * (b2 * c2 - bc * bc) -
+            ab * (ab * c2 - bc * ac) +
+            ac * (ab * bc - b2 * ac)
+        );
+        if (fabs(det) < 1e-12) return false;
+        // Cramer's rule for A p = -(ad, bd, cd).
+        f64 x = -(ad * (b2 * c2 - bc * bc) - ab * (bd * c2 - bc * cd) + ac * (bd * bc - b2 * cd));
+        f64 y = -(a2 * (bd * c2 - cd * bc) - ad * (ab * c2 - bc * ac) + ac * (ab * cd - bd * ac));
+        f64 z = -(a2 * (b2 * cd - bc * bd) - ab * (ab * cd - bd * ac) + ad * (ab * bc - b2 * ac));
+        p = Vec3 { .x = x / det, .y = y / det, .z = z / det };
+        return true;
+    }
+};
+
+struct Collapse {
+    f64 cost;
+    int u, v;  // v is merged into u
+    int u_version, v_version;
+    Vec3 target;
+};
+
+// Faces around a vertex, as a linked list. Merging two vertices links
+// their lists; dead faces are unlinked lazily.
+struct Incidence {
+    int face;
+    int next;
+};
+
+struct Simplifier {
+    Arena* scratch;
+
+    int vertices_count;
+    Vec3* positions;
+    Quadric* quadrics;
+    int* parents;   // union-find of merged vertices
+    int* versions;  // bumped on every change, to spot stale collapses
+    int* heads;
+    int* tails;
+    Incidence* incidences;
+
+    int faces_count;
+    int* corners;  // 3 original vertex indices per face
+    bool* alive;
+    int alive_count;
+
+    Collapse* heap;
+    int heap_count;
+    int heap_capacity;
+};
+
+static int find(Simplifier& s, int v) {
+    int root = v;
+    while (s.parents[root] != root) root = s.parents[root];
+    while (s.parents[v] != root) {
+        int next = s.parents[v];
+        s.parents[v] = root;
+        v = next;
+    }
+    return root;
+}
+
+static bool heap_less(const Collapse& a, const Collapse& b) {
+    return a.cost < b.cost;
+}
+
+static void heap_push(Simplifier& s, const Collapse& c) {
+    if (s.heap_count == s.heap_capacity) {
+        int capacity = s.heap_capacity > 0 ? 2 * s.heap_capacity : 1024;
+        Collapse* heap = s.scratch->push_array<Collapse>(capacity);
+        if (s.heap_count > 0) memcpy(heap, s.heap, s.heap_count * sizeof(Collapse));
+        s.heap = heap;
+        s.heap_capacity = capacity;
+    }
+    int i = s.heap_count++;
+    s.heap[i] = c;
+    while (i > 0 && heap_less(s.heap[i], s.heap[(i - 1) / 2])) {
+        Collapse t = s.heap[i];
+        s.heap[i] = s.heap[(i - 1) / 2];
+        s.heap[(i - 1) / 2] = t;
+        i = (i - 1) / 2;
+    }
+}
+
+static Collapse heap_pop(Simplifier& s) {
+    Collapse top = s.heap[0];
+    s.heap[0] = s.heap[--s.heap_count];
+    int i = 0;
+    while (true) {
+        int smallest = i;
+        int l = 2 * i + 1;
+        int r = 2 * i + 2;
+        if (l < s.heap_count && heap_less(s.heap[l], s.heap[smallest])) smallest = l;
+        if (r < s.heap_count && heap_less(s.heap[r], s.heap[smallest])) smallest = r;
+        if (smallest == i) break;
+        Collapse t = s.heap[i];
+        s.heap[i] = s.heap[smallest];
+        s.heap[smallest] = t;
+        i = smallest;
+    }
+    return top;
+}
+
+static void push_collapse(Simplifier& s, int u, int v) {
+    Quadric q = s.quadrics[u];
+    q.add(s.quadrics[v]);
+
+    Vec3 pu = s.positions[u];
+    Vec3 pv = s.positions[v];
+    Vec3 mid = 0.5 * (pu + pv);
+    Vec3 candidates[4] = { pu, pv, mid, mid };
+    int candidates_count = 3;
+    // The optimum is only trusted close to the edge.
+    Vec3 optimum;
+    if (q.minimum(optimum) && vec3_length(optimum - mid) <= vec3_length(pv - pu)) {
+        candidates[candidates_count++] = optimum;
+    }
+
+    Collapse c = { .cost = F64_INF, .u = u, .v = v, .u_version = s.versions[u], .v_version = s.versions[v] };
+    for (int k = 0; k < candidates_count; k++) {
+        f64 cost = q.error(candidates[k]);
+        if (cost < c.cost) {
+            c.cost = cost;
+            c.target = candidates[k];
+        }
+    }
+    if (c.cost < 0) c.cost = 0;
+    heap_push(s, c);
+}
+
+static Vec3 face_normal(const Vec3& a, const Vec3& b, const Vec3& c) {
+    return vec3_cross(b - a, c - a);
+}
+
+// True if moving u and v to the target would turn a remaining face over.
+static bool collapse_flips(Simplifier& s, const Collapse& c) {
+    int ends[2] = { c.u, c.v };
+    for (int e = 0; e < 2; e++) {
+        for (int n = s.heads[ends[e]]; n != -1; n = s.incidences[n].next) {
+            int f = s.incidences[n].face;
+            if (!s.alive[f]) continue;
+
+            int r[3];
+            bool has_u = false, has_v = false;
+            for (int k = 0; k < 3; k++) {
+                r[k] = find(s, s.corners[3 * f + k]);
+                has_u |= r[k] == c.u;
+                has_v |= r[k] == c.v;
+            }
+            if (has_u && has_v) continue;  // collapses away
+
+            Vec3 before[3], after[3];
+            for (int k = 0; k < 3; k++) {
+                before[k] = s.positions[r[k]];
+                after[k] = r[k] == ends[e] ? c.target : before[k];
+            }
+            Vec3 n0 = face_normal(before[0], before[1], before[2]);
+            Vec3 n1 = face_normal(after[0], after[1], after[2]);
+            if (vec3_dot(n0, n1) <= 0) return true;
+        }
+    }
+    return false;
+}
+
+static void apply_collapse(Simplifier& s, const Collapse& c) {
+    int u = c.u;
+    int v = c.v;
+    s.positions[u] = c.target;
+    s.quadrics[u].add(s.quadrics[v]);
+    s.parents[v] = u;
+    s.versions[u]++;
+    s.versions[v]++;
+
+    if (s.heads[v] != -1) {
+        if (s.heads[u] == -1) {
+            s.heads[u] = s.heads[v];
+        } else {
+            s.incidences[s.tails[u]].next = s.heads[v];
+        }
+        s.tails[u] = s.tails[v];
+        s.heads[v] = s.tails[v] = -1;
+    }
+
+    // Drop the faces that lost an edge, then queue the edges around u again.
+    int prev = -1;
+    for (int n = s.heads[u]; n != -1; n = s.incidences[n].next) {
+        int f = s.incidences[n].face;
+        int r[3];
+        if (s.alive[f]) {
+            for (int k = 0; k < 3; k++) r[k] = find(s, s.corners[3 * f + k]);
+            if (r[0] == r[1] || r[1] == r[2] || r[0] == r[2]) {
+                s.alive[f] = false;
+                s.alive_count--;
+            }
+        }
+        if (!s.alive[f]) {
+            if (prev == -1) {
+                s.heads[u] = s.incidences[n].next;
+            } else {
+                s.incidences[prev].next = s.incidences[n].next;
+            }
+            if (s.tails[u] == n) s.tails[u] = prev;
+            continue;
+        }
+        prev = n;
+        for (int k = 0; k < 3; k++) {
+            if (r[k] != u) push_collapse(s, u, r[k]);
+        }
+    }
+}
+
+struct Edge {
+    int a, b;  // a < b
+    int face;
+};
+
+static int compare_edges(const void* x, const void* y) {
+    const Edge* e = (const Edge*) x;
+    const Edge* f = (const Edge*) y;
+    if (e->a != f->a) return e->a < f->a ? -1 : 1;
+    if (e->b != f->b) return e->b < f->b ? -1 : 1;
+    return e->face - f->face;
+}
+
+static void init_quadrics(Simplifier& s) {
+    for (int f = 0; f < s.faces_count; f++) {
+        const int* c = &s.corners[3 * f];
+        Vec3 n = face_normal(s.positions[c[0]], s.positions[c[1]], s.positions[c[2]]);
+        f64 len = vec3_length(n);
+        if (len == 0) continue;
+        n = n / len;
+        f64 d = -vec3_dot(n, s.positions[c[0]]);
+        for (int k = 0; k < 3; k++) s.quadrics[c[k]].add_plane(n, d, 1);
+    }
+
+    // Edges of a single face are open, a plane through the edge and
+    // perpendicular to the face keeps them from moving inwards.
+    int edges_count = 3 * s.faces_count;
+    Edge* edges = s.scratch->push_array<Edge>(edges_count);
+    for (int f = 0; f < s.faces_count; f++) {
+        for (int k = 0; k < 3; k++) {
+            int a = s.corners[3 * f + k];
+            int b = s.corners[3 * f + (k + 1) % 3];
+            edges[3 * f + k] = Edge { .a = a < b ? a : b, .b = a < b ? b : a, .face = f };
+        }
+    }
+    qsort(edges, edges_count, sizeof(Edge), compare_edges);
+    for (int i = 0; i < edges_count; i++) {
+        bool shared = (
+            (i > 0 && edges[i - 1].a == edges[i].a && edges[i - 1].b == edges[i].b) ||
+            (i + 1 < edges_count && edges[i + 1].a == edges[i].a && edges[i + 1].b == edges[i].b)
+        );
+        if (shared) continue;
+
+        const int* c = &s.corners[3 * edges[i].face];
+        Vec3 face_n = face_normal(s.positions[c[0]], s.positions[c[1]], s.positions[c[2]]);
+        Vec3 pa = s.positions[edges[i].a];
+        Vec3 n = vec3_cross(s.positions[edges[i].b] - pa, face_n);
+        f64 len = vec3_length(n);
+        if (len == 0) continue;
+        n = n / len;
+        f64 d = -vec3_dot(n, pa);
+        s.quadrics[edges[i].a].add_plane(n, d, LOD_BOUNDARY_WEIGHT);
+        s.quadrics[edges[i].b].add_plane(n, d, LOD_BOUNDARY_WEIGHT);
+    }
+}
+
+// Vertex positions and live faces of one level.
+struct Snapshot {
+    Vec3* positions;
+    int* corners;
+    int faces_count;
+};
+
+static void take_snapshot(Simplifier& s, Snapshot& snapshot) {
+    memcpy(snapshot.positions, s.positions, s.vertices_count * sizeof(Vec3));
+    snapshot.faces_count = 0;
+    for (int f = 0; f < s.faces_count; f++) {
+        if (!s.alive[f]) continue;
+        for (int k = 0; k < 3; k++) {
+            snapshot.corners[3 * snapshot.faces_count + k] = find(s, s.corners[3 * f + k]);
+        }
+        snapshot.faces_count++;
+    }
+}
+
+// Keeps only the vertices the faces use.
+static Obj::Mesh* snapshot_mesh(const Snapshot& snapshot, int vertices_count, Arena& arena, Arena& scratch) {
+    int* remap = scratch.push_array<int>(vertices_count);
+    for (int i = 0; i < vertices_count; i++) remap[i] = -1;
+    Vec3* vertices = scratch.push_array<Vec3>(vertices_count);
+    int* corners = scratch.push_array<int>(3 * (size_t) snapshot.faces_count);
+    int used = 0;
+    for (int i = 0; i < 3 * snapshot.faces_count; i++) {
+        int v = snapshot.corners[i];
+        if (remap[v] == -1) {
+            remap[v] = used++;
+            vertices[remap[v]] = snapshot.positions[v];
+        }
+        corners[i] = remap[v];
+    }
+    return Obj::build(used, vertices, snapshot.faces_count, corners, arena);
+}
+
+Obj::Mesh* simplify_mesh(
+    const Obj::Mesh& mesh,
+    f64 max_error,
+    Arena& arena,
+    Arena& scratch,
+    LodStats& stats
+) {
+    int n = mesh.vertices_count;
+    int m = mesh.faces_count;
+    Simplifier s = {
+        .scratch = &scratch,
+        .vertices_count = n,
+        .positions = scratch.push_array<Vec3>(n),
+        .quadrics = scratch.push_array_zero<Quadric>(n),
+        .parents = scratch.push_array<int>(n),
+        .versions = scratch.push_array_zero<int>(n),
+        .heads = scratch.push_array<int>(n),
+        .tails = scratch.push_array<int>(n),
+        .incidences = scratch.push_array<Incidence>(3 * (size_t) m),
+        .faces_count = m,
+        .corners = scratch.push_array<int>(3 * (size_t) m),
+        .alive = scratch.push_array<bool>(m),
+        .alive_count = m,
+        .heap = NULL,
+        .heap_count = 0,
+        .heap_capacity = 0
+    };
+
+    for (int i = 0; i < n; i++) {
+        s.positions[i] = mesh.vertices[i];
+        s.parents[i] = i;
+        s.heads[i] = s.tails[i] = -1;
+    }
+    for (int f = 0; f < m; f++) {
+        s.alive[f] = true;
+        for (int k = 0; k < 3; k++) {
+            int v = (int) (mesh.faces[f].gv[k] - mesh.vertices);
+            s.corners[3 * f + k] = v;
+            int node = 3 * f + k;
+            s.incidences[node] = Incidence { .face = f, .next = -1 };
+            if (s.heads[v] == -1) {
+                s.heads[v] = node;
+            } else {
+                s.incidences[s.tails[v]].next = node;
+            }
+            s.tails[v] = node;
+        }
+    }
+    init_quadrics(s);
+    for (int f = 0; f < m; f++) {
+        for (int k = 0; k < 3; k++) {
+            int a = s.corners[3 * f + k];
+            int b = s.corners[3 * f + (k + 1) % 3];
+            if (a < b) push_collapse(s, a, b);
+            else push_collapse(s, b, a);
+        }
+    }
+
+    Snapshot snapshot = {
+        .positions = scratch.push_array<Vec3>(n),
+        .corners = scratch.push_array<int>(3 * (size_t) m),
+        .faces_count = 0
+    };
+    take_snapshot(s, snapshot);
+    stats = LodStats { .level = 0, .triangles_count = m, .error = 0 };
+
+    f64 error = 0;
+    int target = m / 2;
+    while (s.heap_count > 0 && target >= LOD_MIN_TRIANGLES) {
+        Collapse c = heap_pop(s);
+        if (
+            find(s, c.u) != c.u || find(s, c.v) != c.v ||
+            s.versions[c.u] != c.u_version || s.versions[c.v] != c.v_version
+        ) {
+            continue;
+        }
+        // Every collapse left costs at least this much.
+        if (sqrt(c.cost) > max_error) break;
+        if (collapse_flips(s, c)) continue;
+
+        apply_collapse(s, c);
+        error = fmax(error, sqrt(c.cost));
+        if (s.alive_count <= target) {
+            take_snapshot(s, snapshot);
+            stats.level++;
+            stats.triangles_count = snapshot.faces_count;
+            stats.error = error;
+            target /= 2;
+        }
+    }
+
+    return snapshot_mesh(snapshot, n, arena, scratch);
+}
+
+f64 lod_max_error(const Camera& camera, const Obj::Mesh& mesh, f64 pixels) {
+    if (mesh.vertices_count == 0) return 0;
+    Vec3 lo = mesh.vertices[0];
+    Vec3 hi = mesh.vertices[0];
+    for (int i = 1; i < mesh.vertices_count; i++) {
+        Vec3 v = mesh.vertices[i];
+        lo = Vec3 { .x = fmin(lo.x, v.x), .y = fmin(lo.y, v.y), .z = fmin(lo.z, v.z) };
+        hi = Vec3 { .x = fmax(hi.x, v.x), .y = fmax(hi.y, v.y), .z = fmax(hi.z, v.z) };
+    }
+    Vec3 center = 0.5 * (lo + hi);
+    f64 radius = 0;
+    for (int i = 0; i < mesh.vertices_count; i++) {
+        radius = fmax(radius, vec3_length(mesh.vertices[i] - center));
+    }
+
+    // The image plane is |d0.z| in front of the camera and 2 units wide, a
+    // length at depth z covers |d0.z| * width / (2 * z) pixels.
+    Vec3 d0 = camera.pixel_ray(0, 0).direction;
+    if (d0.z == 0) return 0;
+    f64 depth = (center.z - camera.origin.z) * (d0.z > 0 ? 1 : -1) - radius;
+    if (depth <= 0) return 0;
+    return pixels * 2 * depth / (fabs(d0.z) * camera.width);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "obj.h"
+#include "render.h"
+#include "arena.h"
+
+struct LodStats {
+    int level;            // level picked, 0 for the original mesh
+    int triangles_count;  // triangles in the picked level
+    f64 error;            // its error, in world units
+};
+
+// Level of detail by quadric error edge collapse (Garland and Heckbert).
+// Edges are collapsed cheapest first into a chain of levels, each with half
+// the triangles of the one before; the coarsest level whose error is still
+// within `max_error` is returned. The error of a level is the largest root
+// of a collapse's quadric cost so far, roughly the distance the surface
+// moved. Open edges are held in place by extra planes, so silhouettes of
+// open meshes don't shrink.
+//
+// The mesh is allocated in `arena`; the working state goes to `scratch`,
+// which can be reset afterwards.
+Obj::Mesh* simplify_mesh(
+    const Obj::Mesh& mesh,
+    f64 max_error,
+    Arena& arena,
+    Arena& scratch,
+    LodStats& stats
+);
+
+// Largest error in world units that projects to at most `pixels` from the
+// camera, anywhere on the mesh's bounding sphere (so at any turntable angle).
+// 0 when the camera is inside the sphere.
+f64 lod_max_error(const Camera& camera, const Obj::Mesh& mesh, f64 pixels);
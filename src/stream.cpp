@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "stream.h"
+#include "trace.h"
+
+struct Band {
+    bool done;
+    FrameBuffer rows;
+    EncodedBand encoded;
+};
+
+struct BandQueue {
+    const Camera* camera;
+    const Scene* scene;
+    Counter* counter;
+
+    int band_height;
+    int bands_count;
+    int window;
+    Band* slots;  // band `i` is rendered into slot `i % window`
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int next_band;
+    int written_bands;
+};
+
+static void render_band(BandQueue& queue, int band, FrameBuffer& rows) {
+    TRACE_SCOPE("band", band);
+    const Camera& camera = *queue.camera;
+    int first_row = band * queue.band_height;
+    rows.height = queue.band_height;
+    if (first_row + rows.height > camera.height) {
+        rows.height = camera.height - first_row;
+    }
+    for (int row = 0; row < rows.height; row++) {
+        for (int col = 0; col < rows.width; col++) {
+            int hit = trace_ray(*queue.scene, camera.pixel_ray(first_row + row, col));
+            rows.set(row, col, hit >= 0 ? get_rand_color(hit) : RGB());
+        }
+    }
+    queue.counter->inc((i64) rows.height * rows.width);
+}
+
+struct BandWorker {
+    BandQueue* queue;
+    BandEncoder encoder;
+};
+
+static void* band_worker(void* arg) {
+    BandWorker& worker = *(BandWorker*) arg;
+    BandQueue& queue = *worker.queue;
+    trace_thread_name("band");
+    while (true) {
+        pthread_mutex_lock(&queue.mutex);
+        while (
+            queue.next_band < queue.bands_count &&
+            queue.next_band >= queue.written_bands + queue.window
+        ) {
+            pthread_cond_wait(&queue.cond, &queue.mutex);
+        }
+        if (queue.next_band == queue.bands_count) {
+            pthread_mutex_unlock(&queue.mutex);
+            break;
+        }
+        int band = queue.next_band++;
+        pthread_mutex_unlock(&queue.mutex);
+
+        Band& slot = queue.slots[band % queue.window];
+        render_band(queue, band, slot.rows);
+        encode_band(worker.encoder, slot.rows, slot.encoded);
+
+        pthread_mutex_lock(&queue.mutex);
+        slot.done = true;
+        pthread_cond_broadcast(&queue.cond);
+        pthread_mutex_unlock(&queue.mutex);
+    }
+    return NULL;
+}
+
+bool render_streaming(
+    const Camera& camera,
+    const Scene& scene,
+    const StreamConfig& config,
+    Counter* counter,
+    ImageWriter& writer,
+    Arena& arena
+) {
+    BandQueue queue = {
+        .camera = &camera,
+        .scene = &scene,
+        .counter = counter,
+        .band_height = config.band_height,
+        .bands_count = (camera.height + config.band_height - 1) / config.band_height,
+        .window = config.window,
+        .slots = NULL,
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .next_band = 0,
+        .written_bands = 0
+    };
+    if (queue.window > queue.bands_count) queue.window = queue.bands_count;
+
+    size_t band_pixels = (size_t) config.band_height * camera.width;
+    queue.slots = arena.push_array_zero<Band>(queue.window);
+    RGB* pixels = arena.push_array<RGB>(band_pixels * queue.window);
+    for (int i = 0; i < queue.window; i++) {
+        queue.slots[i].rows = FrameBuffer {
+            .buffer = pixels + i * band_pixels,
+            .width = camera.width,
+            .height = config.band_height
+        };
+    }
+
+    pthread_t* threads = arena.push_array<pthread_t>(config.threads);
+    BandWorker* workers = arena.push_array<BandWorker>(config.threads);
+    for (int i = 0; i < config.threads; i++) {
+        workers[i] = BandWorker {
+            .queue = &queue,
+            .encoder = band_encoder(writer.format, camera.width, config.band_height, arena)
+        };
+        pthread_create(&threads[i], NULL, band_worker, (void*)(&workers[i]));
+    }
+
+    writer.begin();
+    for (int band = 0; band < queue.bands_count; band++) {
+        Band& slot = queue.slots[band % queue.window];
+
+        pthread_mutex_lock(&queue.mutex);
+        while (!slot.done) pthread_cond_wait(&queue.cond, &queue.mutex);
+        pthread_mutex_unlock(&queue.mutex);
+
+        // A failed write is remembered by the writer, the remaining bands
+        // are still drained so that the workers can finish.
+        {
+            TRACE_SCOPE("write", band);
+            writer.write_band(slot.encoded);
+        }
+
+        pthread_mutex_lock(&queue.mutex);
+        slot.done = false;
+        queue.written_bands++;
+        pthread_cond_broadcast(&queue.cond);
+        pthread_mutex_unlock(&queue.mutex);
+    }
+
+    writer.end();
+
+    for (int i = 0; i < config.threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < queue.window; i++) {
+        queue.slots[i].encoded.bytes.release();
+    }
+    return writer.ok;
+}
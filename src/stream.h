@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdio.h>
+#include "render.h"
+#include "encode.h"
+#include "arena.h"
+
+// Streaming renderer: the image is split into horizontal bands of
+// `band_height` rows which the threads pick up in order. A thread renders a
+// band and encodes it right away; the encoded band is written to the output
+// as soon as all the bands above it have been written. At most `window`
+// bands are held in memory at any time, so memory use does not depend on
+// the image height.
+struct StreamConfig {
+    int threads;
+    int band_height;
+    int window;
+};
+
+bool render_streaming(
+    const Camera& camera,
+    const Scene& scene,
+    const StreamConfig& config,
+    Counter* counter,
+    ImageWriter& writer,
+    Arena& arena
+);
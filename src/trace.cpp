@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "trace.h"
+
+bool trace_enabled = false;
+
+struct TraceEvent {
+    const char* name;
+    i64 start_ns;
+    i64 end_ns;
+    i64 index;
+};
+
+struct TraceThread {
+    TraceThread* next;
+    int id;
+    const char* name;
+    TraceEvent* events;
+    size_t events_count;
+    size_t events_capacity;
+};
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TraceThread* trace_threads = NULL;
+static int trace_threads_count = 0;
+static i64 trace_start_ns = 0;
+static thread_local TraceThread* trace_thread = NULL;
+
+void trace_start() {
+    trace_start_ns = now_ns();
+    trace_enabled = true;
+}
+
+static TraceThread& current_thread() {
+    if (trace_thread == NULL) {
+        trace_thread = (TraceThread*) calloc(1, sizeof(TraceThread));
+        if (trace_thread == NULL) {
+            fprintf(stderr, "Out of memory for trace events\n");
+            exit(1);
+        }
+        pthread_mutex_lock(&trace_mutex);
+        trace_thread->id = ++trace_threads_count;
+        trace_thread->next = trace_threads;
+        trace_threads = trace_thread;
+        pthread_mutex_unlock(&trace_mutex);
+    }
+    return *trace_thread;
+}
+
+void trace_thread_name(const char* name) {
+    if (trace_enabled) current_thread().name = name;
+}
+
+void trace_record(const char* name, i64 start_ns, i64 end_ns, i64 index) {
+    TraceThread& thread = current_thread();
+    if (thread.events_count == thread.events_capacity) {
+        size_t capacity = thread.events_capacity > 0 ? 2 * thread.events_capacity : 1024;
+        TraceEvent* events = (TraceEvent*) realloc(thread.events, capacity * sizeof(TraceEvent));
+        if (events == NULL) {
+            fprintf(stderr, "Out of memory for trace events\n");
+            exit(1);
+        }
+        thread.events = events;
+        thread.events_capacity = capacity;
+    }
+    thread.events[thread.events_count++] = TraceEvent {
+        .name = name,
+        .start_ns = start_ns,
+        .end_ns = end_ns,
+        .index = index
+    };
+}
+
+bool trace_write(const char* file_name) {
+    FILE* f = fopen(file_name, "w");
+    if (f == NULL) return false;
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (TraceThread* thread = trace_threads; thread != NULL; thread = thread->next) {
+        if (thread->name != NULL) {
+            fprintf(
+                f,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n",
+                thread->id,
+                thread->name
+            );
+            first = false;
+        }
+        for (size_t i = 0; i < thread->events_count; i++) {
+            const TraceEvent& e = thread->events[i];
+            fprintf(
+                f,
+                "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                first ? "" : ",\n",
+                e.name,
+                thread->id,
+                (e.start_ns - trace_start_ns) / 1e3,
+                (e.end_ns - e.start_ns) / 1e3
+            );
+            if (e.index >= 0) fprintf(f, ",\"args\":{\"index\":%lld}", (long long) e.index);
+            fprintf(f, "}");
+            first = false;
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.h"
+
+// Timeline instrumentation in Chrome's trace_event format, for viewing in
+// chrome://tracing or Perfetto. Every thread records its spans into a
+// buffer of its own; `trace_write` writes all of them once the threads are
+// done. Until `trace_start` is called a span costs one branch.
+extern bool trace_enabled;
+
+void trace_start();
+
+// Names the calling thread's track in the viewer.
+void trace_thread_name(const char* name);
+
+// Records a finished span on the calling thread. `index` (a tile, band or
+// frame number) is shown with the span unless it is negative.
+void trace_record(const char* name, i64 start_ns, i64 end_ns, i64 index);
+
+bool trace_write(const char* file_name);
+
+struct TraceScope {
+    const char* name;
+    i64 index;
+    i64 start_ns;
+
+    TraceScope(const char* name, i64 index = -1) : name(name), index(index) {
+        start_ns = trace_enabled ? now_ns() : 0;
+    }
+
+    ~TraceScope() {
+        if (trace_enabled) trace_record(name, start_ns, now_ns(), index);
+    }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Records a span from here to the end of the enclosing block.
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
@@ -1,5 +1,6 @@
 #include "vec3.h"
 #include <stdio.h>
+#include <math.h>
 
 void Vec3::print() const {
     fprint(stdout);
@@ -64,3 +65,7 @@ Vec3 vec3_cross(const Vec3& v, const Vec3& u) {
         .z = v.x * u.y - v.y * u.x,
     };
 }
+
+f64 vec3_length(const Vec3& v) {
+    return sqrt(vec3_dot(v, v));
+}
@@ -1,9 +1,8 @@
 #pragma once
 
+#include <stdio.h>
 #include "common.h"
 
-typedef struct __sFILE FILE;
-
 struct Vec3 {
     f64 x, y, z;
 
@@ -22,3 +21,4 @@ bool operator!=(const Vec3& v, const Vec3& u);
 
 f64  vec3_dot(const Vec3& v, const Vec3& u);
 Vec3 vec3_cross(const Vec3& v, const Vec3& u);
+f64  vec3_length(const Vec3& v);